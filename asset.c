@@ -27,6 +27,7 @@
  * 02/09/21 - Chenxi Zhou: Created                                               *
  *                                                                               *
  *********************************************************************************/
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
@@ -166,6 +167,24 @@ inline uint32_t div_ceil(uint64_t x, uint32_t y)
     return 1 + b;
 }
 
+int8_t has_file_ext(const char *f, const char *ext)
+{
+    size_t l = strlen(f), n = strlen(ext);
+    return l >= n && strcmp(f + l - n, ext) == 0;
+}
+
+// parse a number with an optional K/M/G suffix
+double parse_num(const char *str)
+{
+    double x;
+    char *p;
+    x = strtod(str, &p);
+    if (*p == 'G' || *p == 'g') x *= 1e9;
+    else if (*p == 'M' || *p == 'm') x *= 1e6;
+    else if (*p == 'K' || *p == 'k') x *= 1e3;
+    return x;
+}
+
 uint64_t linear_scale(uint64_t g, int *scale, uint64_t max_g)
 {
     int s;
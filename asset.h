@@ -50,6 +50,8 @@ int file_copy(char *fin, char *fout);
 int8_t is_read_pair(const char *rname0, const char *rname1);
 uint32_t div_ceil(uint64_t x, uint32_t y);
 uint64_t linear_scale(uint64_t g, int *scale, uint64_t max_g);
+double parse_num(const char *str);
+int8_t has_file_ext(const char *f, const char *ext);
 #ifdef __cplusplus
 }
 #endif
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <pthread.h>
 #include "bamlite.h"
 
 #ifdef USE_MALLOC_WRAPPERS
@@ -165,6 +166,365 @@ int bam_read1(bamFile fp, bam1_t *b)
 }
 
 
+/*******************************
+ * multithreaded BGZF decoding *
+ *******************************/
+
+#define BGZF_BLOCK_SIZE     0x10000
+#define BGZF_HEADER_SIZE    18
+#define BGZF_FOOTER_SIZE    8
+#define BGZF_JOB_N_BLOCKS   64
+
+enum { BGZF_JOB_EMPTY, BGZF_JOB_READ, BGZF_JOB_BUSY, BGZF_JOB_DONE };
+
+typedef struct {
+	int state, n_blocks, err;
+	int64_t id;
+	uint8_t *cdata; // compressed blocks, back to back
+	int *c_off; // start of each block in cdata, of size n_blocks + 1
+	uint8_t *udata; // decompressed data
+	int u_len;
+} bgzf_job_t;
+
+struct bgzf_mt_s {
+	FILE *fp;
+	int n_threads, n_jobs;
+	pthread_t reader, *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t cv_reader, cv_worker, cv_consumer;
+	bgzf_job_t *jobs;
+	int64_t read_id, eof_id, consume_id;
+	int stop;
+	bgzf_job_t *cur; // job being consumed
+	int pos; // position in cur->udata
+};
+
+static inline uint16_t bgzf_u16(const uint8_t *p) { return p[0] | (uint16_t)p[1]<<8; }
+static inline uint32_t bgzf_u32(const uint8_t *p) { return p[0] | (uint32_t)p[1]<<8 | (uint32_t)p[2]<<16 | (uint32_t)p[3]<<24; }
+
+// return the total block size or -1 if the header is not a BGZF header
+static int bgzf_block_size(const uint8_t *h)
+{
+	if (h[0] != 31 || h[1] != 139 || h[2] != 8 || (h[3]&4) == 0) return -1;
+	if (bgzf_u16(h + 10) != 6 || h[12] != 'B' || h[13] != 'C' || bgzf_u16(h + 14) != 2) return -1;
+	return bgzf_u16(h + 16) + 1;
+}
+
+// read up to BGZF_JOB_N_BLOCKS blocks; return 0 on EOF, -1 on truncated or invalid input
+static int bgzf_job_fill(bgzf_job_t *job, FILE *fp)
+{
+	int bsize;
+	job->n_blocks = job->err = 0;
+	job->c_off[0] = 0;
+	while (job->n_blocks < BGZF_JOB_N_BLOCKS) {
+		uint8_t *h = job->cdata + job->c_off[job->n_blocks];
+		size_t l = fread(h, 1, BGZF_HEADER_SIZE, fp);
+		if (l == 0) break;
+		if (l != BGZF_HEADER_SIZE || (bsize = bgzf_block_size(h)) < BGZF_HEADER_SIZE + BGZF_FOOTER_SIZE)
+			return -1;
+		if (fread(h + BGZF_HEADER_SIZE, 1, bsize - BGZF_HEADER_SIZE, fp) != bsize - BGZF_HEADER_SIZE)
+			return -1;
+		job->c_off[job->n_blocks + 1] = job->c_off[job->n_blocks] + bsize;
+		++job->n_blocks;
+	}
+	return job->n_blocks;
+}
+
+static int bgzf_job_inflate(bgzf_job_t *job, z_stream *zs)
+{
+	int i, bsize;
+	uint32_t isize, crc;
+	uint8_t *b;
+	job->u_len = 0;
+	for (i = 0; i < job->n_blocks; ++i) {
+		b = job->cdata + job->c_off[i];
+		bsize = job->c_off[i + 1] - job->c_off[i];
+		isize = bgzf_u32(b + bsize - 4);
+		if (isize > BGZF_BLOCK_SIZE) return -1;
+		if (inflateReset(zs) != Z_OK) return -1;
+		zs->next_in = b + BGZF_HEADER_SIZE;
+		zs->avail_in = bsize - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+		zs->next_out = job->udata + job->u_len;
+		zs->avail_out = BGZF_BLOCK_SIZE;
+		if (inflate(zs, Z_FINISH) != Z_STREAM_END || zs->total_out != isize) return -1;
+		crc = crc32(crc32(0L, NULL, 0L), job->udata + job->u_len, isize);
+		if (crc != bgzf_u32(b + bsize - 8)) return -1;
+		job->u_len += isize;
+	}
+	return 0;
+}
+
+static void *bgzf_reader_thread(void *data)
+{
+	bgzf_mt_t *mt = (bgzf_mt_t *)data;
+	bgzf_job_t *job;
+	int ret, stop, trunc = 0;
+	while (1) {
+		pthread_mutex_lock(&mt->lock);
+		job = &mt->jobs[mt->read_id % mt->n_jobs];
+		while (!mt->stop && job->state != BGZF_JOB_EMPTY)
+			pthread_cond_wait(&mt->cv_reader, &mt->lock);
+		stop = mt->stop;
+		pthread_mutex_unlock(&mt->lock);
+		if (stop) break;
+		if (trunc) {
+			// hand out the complete blocks before reporting truncated input
+			job->n_blocks = 0;
+			ret = -1;
+		} else {
+			ret = bgzf_job_fill(job, mt->fp);
+			if (ret < 0 && job->n_blocks > 0)
+				trunc = 1, ret = job->n_blocks;
+		}
+		pthread_mutex_lock(&mt->lock);
+		job->id = mt->read_id;
+		if (ret > 0) {
+			job->state = BGZF_JOB_READ;
+			++mt->read_id;
+			pthread_cond_signal(&mt->cv_worker);
+		} else {
+			// the last job carries the error flag to the consumer
+			job->err = ret < 0;
+			job->u_len = 0;
+			job->state = BGZF_JOB_DONE;
+			mt->eof_id = mt->read_id;
+			pthread_cond_broadcast(&mt->cv_consumer);
+		}
+		pthread_mutex_unlock(&mt->lock);
+		if (ret <= 0) break;
+	}
+	return 0;
+}
+
+static void *bgzf_worker_thread(void *data)
+{
+	bgzf_mt_t *mt = (bgzf_mt_t *)data;
+	bgzf_job_t *job;
+	z_stream zs;
+	int i;
+	memset(&zs, 0, sizeof(z_stream));
+	if (inflateInit2(&zs, -15) != Z_OK) {
+		fprintf(stderr, "[bgzf_worker_thread] failed to initialise zlib stream\n");
+		return 0;
+	}
+	while (1) {
+		pthread_mutex_lock(&mt->lock);
+		job = 0;
+		while (!mt->stop) {
+			// the oldest job waiting for decompression
+			for (i = 0; i < mt->n_jobs; ++i)
+				if (mt->jobs[i].state == BGZF_JOB_READ && (job == 0 || mt->jobs[i].id < job->id))
+					job = &mt->jobs[i];
+			if (job) break;
+			pthread_cond_wait(&mt->cv_worker, &mt->lock);
+		}
+		if (job) job->state = BGZF_JOB_BUSY;
+		pthread_mutex_unlock(&mt->lock);
+		if (!job) break;
+		job->err = bgzf_job_inflate(job, &zs) < 0;
+		pthread_mutex_lock(&mt->lock);
+		job->state = BGZF_JOB_DONE;
+		pthread_cond_broadcast(&mt->cv_consumer);
+		pthread_mutex_unlock(&mt->lock);
+	}
+	inflateEnd(&zs);
+	return 0;
+}
+
+// make the next job in file order available to the consumer; return 0 on EOF and -1 on error
+static int bgzf_mt_next_job(bgzf_mt_t *mt)
+{
+	bgzf_job_t *job;
+	pthread_mutex_lock(&mt->lock);
+	if (mt->cur) {
+		mt->cur->state = BGZF_JOB_EMPTY;
+		mt->cur = 0;
+		++mt->consume_id;
+		pthread_cond_signal(&mt->cv_reader);
+	}
+	job = &mt->jobs[mt->consume_id % mt->n_jobs];
+	while (job->state != BGZF_JOB_DONE || job->id != mt->consume_id)
+		pthread_cond_wait(&mt->cv_consumer, &mt->lock);
+	pthread_mutex_unlock(&mt->lock);
+	if (job->err) {
+		fprintf(stderr, "[bgzf_mt_read] truncated or corrupted BGZF block\n");
+		return -1;
+	}
+	if (mt->consume_id == mt->eof_id)
+		return 0;
+	mt->cur = job;
+	mt->pos = 0;
+	return 1;
+}
+
+bgzf_mt_t *bgzf_mt_open(const char *fn, int n_threads)
+{
+	bgzf_mt_t *mt;
+	FILE *fp;
+	uint8_t h[BGZF_HEADER_SIZE];
+	int i;
+
+	if ((fp = fopen(fn, "rb")) == 0) return 0;
+	// only BGZF input is decompressed block by block
+	if (fread(h, 1, BGZF_HEADER_SIZE, fp) != BGZF_HEADER_SIZE || bgzf_block_size(h) < 0) {
+		fclose(fp);
+		return 0;
+	}
+	rewind(fp);
+
+	mt = (bgzf_mt_t *)calloc(1, sizeof(bgzf_mt_t));
+	mt->fp = fp;
+	mt->n_threads = n_threads < 1? 1 : n_threads;
+	mt->n_jobs = mt->n_threads * 2 + 2;
+	mt->eof_id = INT64_MAX;
+	mt->jobs = (bgzf_job_t *)calloc(mt->n_jobs, sizeof(bgzf_job_t));
+	for (i = 0; i < mt->n_jobs; ++i) {
+		mt->jobs[i].cdata = (uint8_t *)malloc(BGZF_JOB_N_BLOCKS * BGZF_BLOCK_SIZE);
+		mt->jobs[i].c_off = (int *)malloc((BGZF_JOB_N_BLOCKS + 1) * sizeof(int));
+		mt->jobs[i].udata = (uint8_t *)malloc(BGZF_JOB_N_BLOCKS * BGZF_BLOCK_SIZE);
+	}
+	pthread_mutex_init(&mt->lock, 0);
+	pthread_cond_init(&mt->cv_reader, 0);
+	pthread_cond_init(&mt->cv_worker, 0);
+	pthread_cond_init(&mt->cv_consumer, 0);
+	mt->workers = (pthread_t *)malloc(mt->n_threads * sizeof(pthread_t));
+	for (i = 0; i < mt->n_threads; ++i)
+		pthread_create(&mt->workers[i], 0, bgzf_worker_thread, mt);
+	pthread_create(&mt->reader, 0, bgzf_reader_thread, mt);
+	return mt;
+}
+
+int bgzf_mt_read(bgzf_mt_t *mt, void *buf, int len)
+{
+	int l, n = 0, ret;
+	while (n < len) {
+		if (mt->cur == 0 || mt->pos == mt->cur->u_len) {
+			if ((ret = bgzf_mt_next_job(mt)) <= 0)
+				return ret < 0? -1 : n;
+			continue;
+		}
+		l = mt->cur->u_len - mt->pos;
+		if (l > len - n) l = len - n;
+		memcpy((uint8_t *)buf + n, mt->cur->udata + mt->pos, l);
+		mt->pos += l;
+		n += l;
+	}
+	return n;
+}
+
+void bgzf_mt_close(bgzf_mt_t *mt)
+{
+	int i;
+	if (mt == 0) return;
+	pthread_mutex_lock(&mt->lock);
+	mt->stop = 1;
+	pthread_cond_broadcast(&mt->cv_reader);
+	pthread_cond_broadcast(&mt->cv_worker);
+	pthread_mutex_unlock(&mt->lock);
+	pthread_join(mt->reader, 0);
+	for (i = 0; i < mt->n_threads; ++i)
+		pthread_join(mt->workers[i], 0);
+	for (i = 0; i < mt->n_jobs; ++i) {
+		free(mt->jobs[i].cdata);
+		free(mt->jobs[i].c_off);
+		free(mt->jobs[i].udata);
+	}
+	free(mt->jobs);
+	free(mt->workers);
+	pthread_mutex_destroy(&mt->lock);
+	pthread_cond_destroy(&mt->cv_reader);
+	pthread_cond_destroy(&mt->cv_worker);
+	pthread_cond_destroy(&mt->cv_consumer);
+	fclose(mt->fp);
+	free(mt);
+}
+
+bamFile bam_open_mt(const char *fn, const char *mode, int n_threads)
+{
+	bamFile fp;
+	fp = (bamFile)calloc(1, sizeof(bam_file_t));
+	// fall back to a single zlib stream for stdin, plain gzip or a single thread
+	if (n_threads > 1 && strcmp(fn, "-") && strstr(mode, "r"))
+		fp->mt = bgzf_mt_open(fn, n_threads);
+	if (fp->mt == 0) {
+#ifdef USE_VERBOSE_ZLIB_WRAPPERS
+		fp->gz = bamlite_gzopen(fn, mode);
+#else
+		fp->gz = gzopen(fn, mode);
+#endif
+		if (fp->gz == 0) {
+			free(fp);
+			return 0;
+		}
+	}
+	return fp;
+}
+
+// point to the next len bytes of the decompressed stream, in place if they are
+// within the current BGZF job, otherwise through the scratch buffer
+static int bam_read_ptr(bamFile fp, int len, uint8_t **data)
+{
+	bgzf_mt_t *mt = fp->mt;
+	int ret;
+	if (mt) {
+		if (mt->cur == 0 || mt->pos == mt->cur->u_len)
+			if ((ret = bgzf_mt_next_job(mt)) <= 0)
+				return ret;
+		if (mt->cur->u_len - mt->pos >= len) {
+			*data = mt->cur->udata + mt->pos;
+			mt->pos += len;
+			return len;
+		}
+	}
+	if (fp->m_buf < len) {
+		fp->m_buf = len;
+		kroundup32(fp->m_buf);
+		fp->buf = (uint8_t*)realloc(fp->buf, fp->m_buf);
+	}
+	*data = fp->buf;
+	return bam_read(fp, fp->buf, len);
+}
+
+// read one record without copying or decoding it; *data points to the core
+// fields (see bam_raw_* accessors) and stays valid until the next read
+int bam_read1_raw(bamFile fp, uint8_t **data)
+{
+	int32_t block_len;
+	int ret;
+	if ((ret = bam_read_ptr(fp, 4, data)) != 4)
+		return ret == 0? -1 : -2;
+	block_len = (int32_t)bam_raw_u32(*data, 0);
+	if (block_len < (int32_t)sizeof(bam1_core_t)) return -3;
+	if (bam_read_ptr(fp, block_len, data) != block_len) return -4;
+	if (bam_raw_l_qname(*data) + bam_raw_n_cigar(*data) * 4 + sizeof(bam1_core_t) > block_len) return -4;
+	return block_len;
+}
+
+int bam_read(bamFile fp, void *buf, int size)
+{
+	if (fp->mt) return bgzf_mt_read(fp->mt, buf, size);
+#ifdef USE_VERBOSE_ZLIB_WRAPPERS
+	return bamlite_gzread(fp->gz, buf, size);
+#else
+	return gzread(fp->gz, buf, size);
+#endif
+}
+
+int bam_close(bamFile fp)
+{
+	int ret = 0;
+	if (fp == 0) return 0;
+	if (fp->mt) bgzf_mt_close(fp->mt);
+#ifdef USE_VERBOSE_ZLIB_WRAPPERS
+	else ret = bamlite_gzclose(fp->gz);
+#else
+	else ret = gzclose(fp->gz);
+#endif
+	free(fp->buf);
+	free(fp);
+	return ret;
+}
+
 #ifdef USE_VERBOSE_ZLIB_WRAPPERS
 // Versions of gzopen, gzread and gzclose that print up error messages
 
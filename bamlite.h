@@ -10,19 +10,19 @@
 
 #define USE_VERBOSE_ZLIB_WRAPPERS
 
-typedef gzFile bamFile;
-#ifdef USE_VERBOSE_ZLIB_WRAPPERS
-/* These print error messages on failure */
-#  define bam_open(fn, mode)      bamlite_gzopen(fn, mode)
-#  define bam_dopen(fd, mode)     gzdopen(fd, mode)
-#  define bam_close(fp)           bamlite_gzclose(fp)
-#  define bam_read(fp, buf, size) bamlite_gzread(fp, buf, size)
-#else
-#  define bam_open(fn, mode)      gzopen(fn, mode)
-#  define bam_dopen(fd, mode)     gzdopen(fd, mode)
-#  define bam_close(fp)           gzclose(fp)
-#  define bam_read(fp, buf, size) gzread(fp, buf, size)
-#endif /* USE_VERBOSE_ZLIB_WRAPPERS */
+/* multithreaded BGZF reader: one thread reading compressed blocks and
+ * n_threads workers inflating them; data is handed out in file order */
+typedef struct bgzf_mt_s bgzf_mt_t;
+
+typedef struct {
+	gzFile gz;
+	bgzf_mt_t *mt;
+	int m_buf;
+	uint8_t *buf; // scratch for records not contiguous in the decompressed data
+} bam_file_t;
+
+typedef bam_file_t *bamFile;
+#define bam_open(fn, mode)      bam_open_mt(fn, mode, 0)
 
 typedef struct {
 	int32_t n_targets;
@@ -85,6 +85,21 @@ typedef struct {
 #define bam1_seqi(s, i) ((s)[(i)/2] >> 4*(1-(i)%2) & 0xf)
 #define bam1_aux(b) ((b)->data + (b)->core.n_cigar*4 + (b)->core.l_qname + (b)->core.l_qseq + ((b)->core.l_qseq + 1)/2)
 
+/* accessors for a raw little-endian record as returned by bam_read1_raw */
+#define bam_raw_u8(d, i)  ((uint32_t)((const uint8_t*)(d))[i])
+#define bam_raw_u16(d, i) (bam_raw_u8(d, i) | bam_raw_u8(d, (i)+1)<<8)
+#define bam_raw_u32(d, i) (bam_raw_u16(d, i) | bam_raw_u16(d, (i)+2)<<16)
+#define bam_raw_tid(d)     ((int32_t)bam_raw_u32(d, 0))
+#define bam_raw_pos(d)     ((int32_t)bam_raw_u32(d, 4))
+#define bam_raw_l_qname(d) bam_raw_u8(d, 8)
+#define bam_raw_qual(d)    bam_raw_u8(d, 9)
+#define bam_raw_n_cigar(d) bam_raw_u16(d, 12)
+#define bam_raw_flag(d)    bam_raw_u16(d, 14)
+#define bam_raw_mtid(d)    ((int32_t)bam_raw_u32(d, 20))
+#define bam_raw_mpos(d)    ((int32_t)bam_raw_u32(d, 24))
+#define bam_raw_qname(d)   ((const char*)(d) + 32)
+#define bam_raw_cigar(d, i) bam_raw_u32(d, 32 + bam_raw_l_qname(d) + (i)*4)
+
 #define bam_init1() ((bam1_t*)calloc(1, sizeof(bam1_t)))
 #define bam_destroy1(b) do {					\
 		if (b) { free((b)->data); free(b); }	\
@@ -100,6 +115,15 @@ extern "C" {
 	void bam_header_destroy(bam_header_t *header);
 	bam_header_t *bam_header_read(bamFile fp);
 	int bam_read1(bamFile fp, bam1_t *b);
+	int bam_read1_raw(bamFile fp, uint8_t **data);
+
+	bamFile bam_open_mt(const char *fn, const char *mode, int n_threads);
+	int bam_read(bamFile fp, void *buf, int size);
+	int bam_close(bamFile fp);
+
+	bgzf_mt_t *bgzf_mt_open(const char *fn, int n_threads);
+	int bgzf_mt_read(bgzf_mt_t *mt, void *buf, int len);
+	void bgzf_mt_close(bgzf_mt_t *mt);
 
 #ifdef USE_VERBOSE_ZLIB_WRAPPERS
 	gzFile bamlite_gzopen(const char *fn, const char *mode);
@@ -0,0 +1,289 @@
+/*********************************************************************************
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2021 Chenxi Zhou <chnx.zhou@gmail.com>                          *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in    *
+ * all copies or substantial portions of the Software.                           *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *********************************************************************************/
+
+/********************************** Revision History *****************************
+ *                                                                               *
+ * 18/10/26 - agent: Created                                                     *
+ *                                                                               *
+ *********************************************************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ketopt.h"
+#include "sdict.h"
+#include "link.h"
+#include "asset.h"
+
+/* benchmark of the inter link matrix accumulation on a synthetic fragmented assembly
+ * random inter-contig links are added to the matrix with and without radix partitioning,
+ * and the two matrices are checked to be identical
+ * the pairs of the matrix are then scored by inter_link_norms with the scalar and the SIMD kernel,
+ * and the two scores are checked to be identical
+ */
+
+static uint64_t rng_s;
+
+static inline uint64_t rng_next(void)
+{
+    uint64_t z = (rng_s += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint32_t *make_links(asm_dict_t *dict, uint32_t resolution, uint64_t n_link, uint64_t seed)
+{
+    uint64_t i;
+    uint32_t n, i0, i1, b0, b1, *a;
+
+    rng_s = seed;
+    n = dict->n;
+    a = (uint32_t *) malloc(n_link * 5 * sizeof(uint32_t));
+    for (i = 0; i < n_link; ++i) {
+        do {
+            i0 = rng_next() % n;
+            i1 = rng_next() % n;
+        } while (i0 == i1);
+        if (i0 > i1)
+            SWAP(uint32_t, i0, i1);
+        b0 = rng_next() % div_ceil(dict->s[i0].len, resolution * 2);
+        b1 = rng_next() % div_ceil(dict->s[i1].len, resolution * 2);
+        a[i * 5] = i0;
+        a[i * 5 + 1] = i1;
+        a[i * 5 + 2] = b0 | (uint32_t) (rng_next() & 1) << 31;
+        a[i * 5 + 3] = b1 | (uint32_t) (rng_next() & 1) << 31;
+        a[i * 5 + 4] = 1;
+    }
+    return a;
+}
+
+// pairs are stored in the order of their first link, so the hash of each pair is summed
+static uint64_t link_mat_hash(inter_link_mat_t *link_mat)
+{
+    uint32_t i, j, k;
+    uint64_t h, s;
+    inter_link_t *link;
+
+    s = 0;
+    for (i = 0; i < link_mat->n; ++i) {
+        link = &link_mat->links[i];
+        h = 14695981039346656037ULL;
+        h = (h ^ ((uint64_t) link->c0 << 32 | link->c1)) * 1099511628211ULL;
+        for (k = 0; k < 4; ++k) {
+            for (j = 0; j < link->n; ++j)
+                h = (h ^ link->link[k][j]) * 1099511628211ULL;
+        }
+        s += h;
+    }
+    return s;
+}
+
+static uint64_t norms_hash(inter_link_mat_t *link_mat)
+{
+    uint32_t i, k;
+    uint64_t h, x;
+
+    h = 14695981039346656037ULL;
+    for (i = 0; i < link_mat->n; ++i) {
+        h = (h ^ link_mat->links[i].n0) * 1099511628211ULL;
+        for (k = 0; k < 4; ++k) {
+            memcpy(&x, &link_mat->links[i].norms[k], sizeof(double));
+            h = (h ^ x) * 1099511628211ULL;
+        }
+    }
+    return h;
+}
+
+// band norms decreasing around the average number of links in a cell
+static norm_t *make_norms(uint32_t radius, double c)
+{
+    uint32_t i;
+    norm_t *norm;
+
+    norm = (norm_t *) calloc(1, sizeof(norm_t));
+    norm->n = radius + 1;
+    norm->r = radius;
+    norm->norms = (double *) malloc((radius + 1) * sizeof(double));
+    for (i = 0; i <= radius; ++i)
+        norm->norms[i] = c * 2 / (i + 1);
+    return norm;
+}
+
+static uint64_t score(inter_link_mat_t *link_mat, norm_t *norm, int simd, int *simd_used, double *t_norm, double *la)
+{
+    uint32_t i;
+    double t;
+
+    for (i = 0; i < link_mat->n; ++i) {
+        memset(link_mat->links[i].norms, 0, sizeof(link_mat->links[i].norms));
+        link_mat->links[i].n0 = 0;
+    }
+    *simd_used = inter_link_norms_simd(simd);
+    t = realtime();
+    inter_link_norms(link_mat, norm, 1, la, 1);
+    *t_norm = realtime() - t;
+    return norms_hash(link_mat);
+}
+
+static uint64_t run(asm_dict_t *dict, uint32_t resolution, uint32_t radius, uint32_t *a, uint64_t n_link, int n_bkt, int n_threads, int *bkt_used, double *t_init, double *t_acc, inter_link_mat_t **keep)
+{
+    uint64_t i, h;
+    double t;
+    inter_link_mat_t *link_mat;
+    inter_link_acc_t *acc;
+
+    t = realtime();
+    link_mat = inter_link_mat_init(dict, 0, resolution, radius);
+    *t_init = realtime() - t;
+
+    t = realtime();
+    acc = inter_link_acc_init(link_mat, radius, n_bkt, n_threads);
+    for (i = 0; i < n_link; ++i)
+        inter_link_acc_push(acc, a + i * 5);
+    inter_link_acc_flush(acc);
+    *t_acc = realtime() - t;
+    *bkt_used = acc->n_bkt;
+    inter_link_acc_destroy(acc);
+
+    h = link_mat_hash(link_mat);
+    if (keep)
+        *keep = link_mat;
+    else
+        inter_link_mat_destroy(link_mat);
+    return h;
+}
+
+static void print_help(FILE *fp_help)
+{
+    fprintf(fp_help, "Usage: bench_link [options]\n");
+    fprintf(fp_help, "Options:\n");
+    fprintf(fp_help, "    -n INT            number of contigs [1000]\n");
+    fprintf(fp_help, "    -l INT            maximum contig length [200000]\n");
+    fprintf(fp_help, "    -r INT            resolution [10000]\n");
+    fprintf(fp_help, "    -R INT            radius in number of bands [10]\n");
+    fprintf(fp_help, "    -N NUM            number of inter-contig links [20M]\n");
+    fprintf(fp_help, "    -b INT            number of buckets, 0 for automatic [0]\n");
+    fprintf(fp_help, "    -t INT            number of threads for the bucketed scatter [1]\n");
+    fprintf(fp_help, "    -s INT            random seed [11]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int c, n_bkt, n_threads, bkt_used, simd_used, ret;
+    uint32_t i, n_ctg, max_len, resolution, radius;
+    uint64_t n_link, seed, h0, h1, n_cell;
+    uint32_t *a;
+    double t_init, t0, t1, la0, la1;
+    char name[32];
+    sdict_t *sdict;
+    asm_dict_t *dict;
+    inter_link_mat_t *link_mat;
+    norm_t *norm;
+    ketopt_t opt = KETOPT_INIT;
+
+    n_ctg = 1000;
+    max_len = 200000;
+    resolution = 10000;
+    radius = 10;
+    n_link = 20000000;
+    n_bkt = 0;
+    n_threads = 1;
+    seed = 11;
+    while ((c = ketopt(&opt, argc, argv, 1, "n:l:r:R:N:b:t:s:h", 0)) >= 0) {
+        if (c == 'n') n_ctg = atoi(opt.arg);
+        else if (c == 'l') max_len = atoi(opt.arg);
+        else if (c == 'r') resolution = atoi(opt.arg);
+        else if (c == 'R') radius = atoi(opt.arg);
+        else if (c == 'N') n_link = (uint64_t) parse_num(opt.arg);
+        else if (c == 'b') n_bkt = atoi(opt.arg);
+        else if (c == 't') n_threads = atoi(opt.arg);
+        else if (c == 's') seed = atol(opt.arg);
+        else if (c == 'h') {
+            print_help(stdout);
+            return 0;
+        } else {
+            print_help(stderr);
+            return 1;
+        }
+    }
+
+    if (n_ctg < 2 || resolution == 0 || max_len < resolution * 2) {
+        fprintf(stderr, "[E::%s] at least two contigs of at least twice the resolution are required\n", __func__);
+        return 1;
+    }
+
+    // contig lengths uniform in [2 x resolution, max_len]
+    rng_s = seed;
+    sdict = sd_init();
+    for (i = 0; i < n_ctg; ++i) {
+        sprintf(name, "ctg%06u", i);
+        sd_put(sdict, name, resolution * 2 + rng_next() % (max_len - resolution * 2 + 1));
+    }
+    dict = make_asm_dict_from_sdict(sdict);
+
+    a = make_links(dict, resolution, n_link, seed);
+    fprintf(stderr, "[I::%s] %u contigs, %lu inter-contig links, resolution %u, radius %u\n", __func__, n_ctg, n_link, resolution, radius);
+    fprintf(stderr, "[I::%s] inter link matrix: %.3fGB\n", __func__, (double) estimate_inter_link_mat_init_rss(dict, resolution, radius, n_link) / (1 << 30));
+
+    h0 = run(dict, resolution, radius, a, n_link, 1, 1, &bkt_used, &t_init, &t0, 0);
+    fprintf(stderr, "[I::%s] direct scatter:     %.3f sec (matrix init %.3f sec)\n", __func__, t0, t_init);
+    h1 = run(dict, resolution, radius, a, n_link, n_bkt, n_threads, &bkt_used, &t_init, &t1, &link_mat);
+    fprintf(stderr, "[I::%s] %5d buckets:       %.3f sec (matrix init %.3f sec, %d threads)\n", __func__, bkt_used, t1, t_init, n_threads);
+    fprintf(stderr, "[I::%s] speedup: %.2fx\n", __func__, t0 / t1);
+    free(a);
+
+    ret = 0;
+    if (h0 != h1) {
+        fprintf(stderr, "[E::%s] matrices differ: %016lx != %016lx\n", __func__, h0, h1);
+        ret = 1;
+    } else {
+        fprintf(stderr, "[I::%s] matrices identical\n", __func__);
+    }
+
+    n_cell = 0;
+    for (i = 0; i < link_mat->n; ++i)
+        n_cell += link_mat->links[i].n;
+    norm = make_norms(radius, n_cell? (double) n_link / n_cell : 1.);
+    link_mat->noise = norm->norms[radius] / 10;
+    h0 = score(link_mat, norm, 0, &simd_used, &t0, &la0);
+    fprintf(stderr, "[I::%s] scalar scoring:     %.3f sec\n", __func__, t0);
+    h1 = score(link_mat, norm, 1, &simd_used, &t1, &la1);
+    fprintf(stderr, "[I::%s] %s scoring:     %.3f sec\n", __func__, simd_used? "  SIMD" : "scalar", t1);
+    fprintf(stderr, "[I::%s] speedup: %.2fx\n", __func__, t0 / t1);
+    if (h0 != h1 || la0 != la1) {
+        fprintf(stderr, "[E::%s] scores differ: %016lx != %016lx\n", __func__, h0, h1);
+        ret = 1;
+    } else {
+        fprintf(stderr, "[I::%s] scores identical\n", __func__);
+    }
+
+    norm_destroy(norm);
+    inter_link_mat_destroy(link_mat);
+    asm_destroy(dict);
+    sd_destroy(sdict);
+
+    return ret;
+}
@@ -0,0 +1,783 @@
+/*********************************************************************************
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2021 Chenxi Zhou <chnx.zhou@gmail.com>                          *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in    *
+ * all copies or substantial portions of the Software.                           *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *********************************************************************************/
+
+/********************************** Revision History *****************************
+ *                                                                               *
+ * 18/10/26 - agent: Created                                                     *
+ *                                                                               *
+ *********************************************************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ksort.h"
+#include "binio.h"
+
+#define bin_rec_lt(a, b) ((a).i0 < (b).i0 || ((a).i0 == (b).i0 && (a).p0 < (b).p0))
+KSORT_INIT(bin_rec, bin_rec_t, bin_rec_lt)
+
+static inline int bin_rec_pair_lt(bin_rec_t a, bin_rec_t b)
+{
+    if (a.i0 != b.i0) return a.i0 < b.i0;
+    if (a.i1 != b.i1) return a.i1 < b.i1;
+    if (a.p0 != b.p0) return a.p0 < b.p0;
+    if (a.p1 != b.p1) return a.p1 < b.p1;
+    return a.qd < b.qd;
+}
+KSORT_INIT(bin_rec_pair, bin_rec_t, bin_rec_pair_lt)
+
+static void bin_write_u32(FILE *fp, uint32_t x)
+{
+    fwrite(&x, sizeof(uint32_t), 1, fp);
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t x)
+{
+    while (x >= 0x80) {
+        *p++ = (uint8_t) (x | 0x80);
+        x >>= 7;
+    }
+    *p++ = (uint8_t) x;
+    return p;
+}
+
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *x)
+{
+    int s = 0;
+    *x = 0;
+    while (p < end && s < 64) {
+        *x |= (uint64_t) (*p & 0x7f) << s;
+        if (!(*p++ & 0x80))
+            return p;
+        s += 7;
+    }
+    return 0;
+}
+
+static inline uint64_t zigzag(int64_t x)
+{
+    return (uint64_t) x << 1 ^ (uint64_t) (x >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t x)
+{
+    return (int64_t) (x >> 1) ^ -(int64_t) (x & 1);
+}
+
+bin_writer_t *bin_writer_open(const char *f, sdict_t *dict, uint8_t mq, uint32_t flags, long max_mem)
+{
+    bin_writer_t *w;
+    uint32_t i, l;
+    uint64_t n_rec;
+
+    w = (bin_writer_t *) calloc(1, sizeof(bin_writer_t));
+    w->fp = fopen(f, "w");
+    if (w->fp == NULL) {
+        fprintf(stderr, "[E::%s] cannot open file %s for writing\n", __func__, f);
+        exit(EXIT_FAILURE);
+    }
+    if (flags & BIN_FLAG_SORTED) {
+        // the index points to blocks
+        flags |= BIN_FLAG_BLOCK;
+        w->n_seq = dict->n;
+        w->idx = (uint64_t *) malloc((size_t) dict->n * 3 * sizeof(uint64_t));
+        memset(w->idx, 0xff, (size_t) dict->n * 3 * sizeof(uint64_t));
+        w->m_srt = MAX((size_t) max_mem / sizeof(bin_rec_t), BIN_BLOCK_SIZE);
+        w->srt = (bin_rec_t *) malloc(w->m_srt * sizeof(bin_rec_t));
+        w->tmp = strdup(f);
+    }
+    w->flags = flags;
+    w->w = flags & BIN_FLAG_QUAL? 5 : 4;
+    if (flags & BIN_FLAG_BLOCK) {
+        w->blk = (bin_rec_t *) malloc(BIN_BLOCK_SIZE * sizeof(bin_rec_t));
+        // varints of at most 5, 5, 10 bytes and two mapq bytes per record, and a group header per record at most
+        w->data = (uint8_t *) malloc(BIN_BLOCK_SIZE * 32);
+    }
+
+    fwrite(BIN_MAGIC, sizeof(char), 4, w->fp);
+    bin_write_u32(w->fp, BIN_VERSION);
+    bin_write_u32(w->fp, flags);
+    bin_write_u32(w->fp, mq);
+    w->rec_off = ftell(w->fp);
+    n_rec = 0;
+    fwrite(&n_rec, sizeof(uint64_t), 1, w->fp);
+    if (flags & BIN_FLAG_SORTED) {
+        w->idx_off = ftell(w->fp);
+        fwrite(&n_rec, sizeof(uint64_t), 1, w->fp);
+    }
+    bin_write_u32(w->fp, dict->n);
+    for (i = 0; i < dict->n; ++i) {
+        l = strlen(dict->s[i].name);
+        bin_write_u32(w->fp, l);
+        fwrite(dict->s[i].name, sizeof(char), l, w->fp);
+        bin_write_u32(w->fp, dict->s[i].len);
+    }
+    w->blk_off = ftell(w->fp);
+
+    return w;
+}
+
+// sort the block by the first mate and encode it
+static void bin_write_block(bin_writer_t *w)
+{
+    uint32_t i, j, i0, p0;
+    uint64_t *idx;
+    uint8_t *p;
+    bin_rec_t *a = w->blk;
+
+    if (w->n_blk == 0)
+        return;
+    ks_introsort_bin_rec(w->n_blk, a);
+
+    p = w->data;
+    i0 = 0;
+    for (i = 0; i < w->n_blk; i = j) {
+        for (j = i + 1; j < w->n_blk && a[j].i0 == a[i].i0; ++j);
+        p = put_varint(p, a[i].i0 - i0);
+        p = put_varint(p, j - i);
+        i0 = a[i].i0;
+        for (p0 = 0; i < j; ++i) {
+            p = put_varint(p, a[i].p0 - p0);
+            p = put_varint(p, (uint64_t) (a[i].i1 - a[i].i0) << 1 | (a[i].qd >> 16 & 1));
+            p = put_varint(p, a[i].i1 == a[i].i0? zigzag((int64_t) a[i].p1 - a[i].p0) : a[i].p1);
+            if (w->flags & BIN_FLAG_QUAL) {
+                *p++ = a[i].qd & 0xff;
+                *p++ = a[i].qd >> 8 & 0xff;
+            }
+            p0 = a[i].p0;
+        }
+    }
+
+    idx = w->idx? &w->idx[(size_t) a[0].i0 * 3] : 0;
+    if (idx) {
+        if (idx[0] == UINT64_MAX)
+            idx[0] = ftell(w->fp);
+        if (a[0].i1 != a[0].i0 && idx[1] == UINT64_MAX)
+            idx[1] = ftell(w->fp);
+    }
+    bin_write_u32(w->fp, w->n_blk);
+    bin_write_u32(w->fp, p - w->data);
+    fwrite(w->data, sizeof(uint8_t), p - w->data, w->fp);
+    if (idx)
+        idx[2] = ftell(w->fp);
+    w->n_blk = 0;
+}
+
+// add a record to the current block, blocks of sorted output hold either intra or inter pairs of one sequence
+static void bin_add_rec(bin_writer_t *w, const bin_rec_t *rec)
+{
+    const bin_rec_t *last;
+
+    if (w->n_blk == BIN_BLOCK_SIZE) {
+        bin_write_block(w);
+    } else if (w->n_blk && w->idx) {
+        last = &w->blk[w->n_blk - 1];
+        if (last->i0 != rec->i0 || (last->i0 == last->i1) != (rec->i0 == rec->i1))
+            bin_write_block(w);
+    }
+    w->blk[w->n_blk++] = *rec;
+}
+
+// write the sorted records to a new run file
+static void bin_write_run(bin_writer_t *w)
+{
+    FILE *fp;
+    char *fn;
+
+    ks_introsort_bin_rec_pair(w->n_srt, w->srt);
+    fn = (char *) malloc(strlen(w->tmp) + 16);
+    sprintf(fn, "%s.sort.%04d.tmp", w->tmp, w->n_run);
+    fp = fopen(fn, "w+");
+    if (fp == NULL) {
+        fprintf(stderr, "[E::%s] cannot open file %s for writing\n", __func__, fn);
+        exit(EXIT_FAILURE);
+    }
+    unlink(fn);
+    free(fn);
+    if (fwrite(w->srt, sizeof(bin_rec_t), w->n_srt, fp) != w->n_srt || fflush(fp)) {
+        fprintf(stderr, "[E::%s] failed to write temporary file\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    rewind(fp);
+    w->run = (FILE **) realloc(w->run, (w->n_run + 1) * sizeof(FILE *));
+    w->run[w->n_run++] = fp;
+    w->n_srt = 0;
+}
+
+static inline int bin_run_lt(const bin_rec_t *a, int ra, const bin_rec_t *b, int rb)
+{
+    return bin_rec_pair_lt(*a, *b) || (!bin_rec_pair_lt(*b, *a) && ra < rb);
+}
+
+static void bin_run_heap_down(int *heap, int n, const bin_rec_t *head, int i)
+{
+    int k, t;
+    while ((k = i * 2 + 1) < n) {
+        if (k + 1 < n && bin_run_lt(&head[heap[k + 1]], heap[k + 1], &head[heap[k]], heap[k]))
+            ++k;
+        if (!bin_run_lt(&head[heap[k]], heap[k], &head[heap[i]], heap[i]))
+            break;
+        t = heap[i], heap[i] = heap[k], heap[k] = t;
+        i = k;
+    }
+}
+
+// merge the sorted runs into blocks
+static void bin_merge_runs(bin_writer_t *w)
+{
+    int i, n, *heap;
+    bin_rec_t *head;
+
+    head = (bin_rec_t *) malloc(w->n_run * sizeof(bin_rec_t));
+    heap = (int *) malloc(w->n_run * sizeof(int));
+    for (i = n = 0; i < w->n_run; ++i)
+        if (fread(&head[i], sizeof(bin_rec_t), 1, w->run[i]) == 1)
+            heap[n++] = i;
+    for (i = n / 2 - 1; i >= 0; --i)
+        bin_run_heap_down(heap, n, head, i);
+    while (n > 0) {
+        i = heap[0];
+        bin_add_rec(w, &head[i]);
+        if (fread(&head[i], sizeof(bin_rec_t), 1, w->run[i]) != 1) {
+            if (ferror(w->run[i])) {
+                fprintf(stderr, "[E::%s] failed to read temporary file\n", __func__);
+                exit(EXIT_FAILURE);
+            }
+            heap[0] = heap[--n];
+        }
+        bin_run_heap_down(heap, n, head, 0);
+    }
+    free(head);
+    free(heap);
+}
+
+void bin_write_pair(bin_writer_t *w, uint32_t i0, uint32_t p0, uint32_t i1, uint32_t p1, uint8_t q0, uint8_t q1, uint8_t dup)
+{
+    bin_rec_t rec;
+
+    if (i0 > i1) {
+        SWAP(uint32_t, i0, i1);
+        SWAP(uint32_t, p0, p1);
+        SWAP(uint8_t, q0, q1);
+    }
+    ++w->n_rec;
+
+    if (w->flags & BIN_FLAG_BLOCK) {
+        rec.i0 = i0;
+        rec.p0 = p0;
+        rec.i1 = i1;
+        rec.p1 = p1;
+        rec.qd = (uint32_t) q0 | (uint32_t) q1 << 8 | (uint32_t) !!dup << 16;
+        if (w->flags & BIN_FLAG_SORTED) {
+            if (w->n_srt == w->m_srt)
+                bin_write_run(w);
+            w->srt[w->n_srt++] = rec;
+        } else {
+            bin_add_rec(w, &rec);
+        }
+        return;
+    }
+
+    if (w->n + w->w > BUFF_SIZE) {
+        fwrite(w->buf, sizeof(uint32_t), w->n, w->fp);
+        w->n = 0;
+    }
+    w->buf[w->n++] = i0;
+    w->buf[w->n++] = p0;
+    w->buf[w->n++] = i1;
+    w->buf[w->n++] = p1;
+    if (w->flags & BIN_FLAG_QUAL)
+        w->buf[w->n++] = (uint32_t) q0 | (uint32_t) q1 << 8 | (uint32_t) !!dup << 16;
+}
+
+// fill in the offsets of sequences without blocks and write the index
+static void bin_write_index(bin_writer_t *w)
+{
+    uint32_t i;
+    uint64_t off, *idx;
+
+    off = ftell(w->fp);
+    fseek(w->fp, w->idx_off, SEEK_SET);
+    fwrite(&off, sizeof(uint64_t), 1, w->fp);
+    fseek(w->fp, 0, SEEK_END);
+
+    for (i = 0; i < w->n_seq; ++i) {
+        idx = &w->idx[(size_t) i * 3];
+        if (idx[0] == UINT64_MAX)
+            idx[0] = i? idx[-1] : w->blk_off;
+        if (idx[2] == UINT64_MAX)
+            idx[2] = idx[0];
+        if (idx[1] == UINT64_MAX)
+            idx[1] = idx[2];
+    }
+    fwrite(w->idx, sizeof(uint64_t), (size_t) w->n_seq * 3, w->fp);
+}
+
+void bin_writer_close(bin_writer_t *w)
+{
+    size_t i;
+    int k;
+
+    if (w->n)
+        fwrite(w->buf, sizeof(uint32_t), w->n, w->fp);
+    if (w->flags & BIN_FLAG_SORTED) {
+        if (w->n_run) {
+            if (w->n_srt)
+                bin_write_run(w);
+            bin_merge_runs(w);
+        } else {
+            ks_introsort_bin_rec_pair(w->n_srt, w->srt);
+            for (i = 0; i < w->n_srt; ++i)
+                bin_add_rec(w, &w->srt[i]);
+        }
+    }
+    bin_write_block(w);
+    if (w->flags & BIN_FLAG_SORTED)
+        bin_write_index(w);
+    fseek(w->fp, w->rec_off, SEEK_SET);
+    fwrite(&w->n_rec, sizeof(uint64_t), 1, w->fp);
+    if (ferror(w->fp) || fclose(w->fp)) {
+        fprintf(stderr, "[E::%s] failed to write BIN file\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    for (k = 0; k < w->n_run; ++k)
+        fclose(w->run[k]);
+    free(w->run);
+    free(w->srt);
+    free(w->idx);
+    free(w->tmp);
+    free(w->blk);
+    free(w->data);
+    free(w);
+}
+
+// return a pointer to the next n bytes, fewer if the end of file is reached
+// the bytes are valid until the next call
+static const uint8_t *bin_get(bin_reader_t *r, size_t n, size_t *l)
+{
+    const uint8_t *p;
+    size_t k;
+
+    if (r->map) {
+        *l = r->off < r->size? MIN(n, r->size - r->off) : 0;
+        p = r->map + r->off;
+        r->off += *l;
+        return p;
+    }
+
+    if (r->l_io - r->i_io < n) {
+        memmove(r->io, r->io + r->i_io, r->l_io - r->i_io);
+        r->l_io -= r->i_io;
+        r->i_io = 0;
+        if (n > r->m_io) {
+            r->m_io = n;
+            r->io = (uint8_t *) realloc(r->io, r->m_io);
+        }
+        while (r->l_io < r->m_io && (k = fread(r->io + r->l_io, 1, r->m_io - r->l_io, r->fp)) > 0)
+            r->l_io += k;
+        if (ferror(r->fp)) {
+            fprintf(stderr, "[E::%s] failed to read BIN file\n", __func__);
+            exit(EXIT_FAILURE);
+        }
+    }
+    *l = MIN(n, r->l_io - r->i_io);
+    p = r->io + r->i_io;
+    r->i_io += *l;
+    r->off += *l;
+    return p;
+}
+
+static void bin_seek(bin_reader_t *r, uint64_t off)
+{
+    if (!r->map) {
+        if (fseek(r->fp, off, SEEK_SET)) {
+            fprintf(stderr, "[E::%s] failed to seek BIN file\n", __func__);
+            exit(EXIT_FAILURE);
+        }
+        r->l_io = r->i_io = 0;
+    }
+    r->off = off;
+}
+
+static void bin_read_header(bin_reader_t *r, void *x, size_t size)
+{
+    size_t l;
+    const uint8_t *p = bin_get(r, size, &l);
+    if (l != size) {
+        fprintf(stderr, "[E::%s] truncated BIN file header\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(x, p, size);
+}
+
+// open a BIN file, sequence ids are mapped to the dictionary by name if it is given
+// pairs with a mate below mapping quality mq or marked as duplicate are skipped if the file keeps them
+// regular files are memory-mapped, others such as pipes are read through a large buffer
+bin_reader_t *bin_reader_open(const char *f, sdict_t *dict, uint8_t mq)
+{
+    bin_reader_t *r;
+    struct stat st;
+    const uint8_t *magic;
+    uint32_t i, l, id;
+    size_t k;
+
+    r = (bin_reader_t *) calloc(1, sizeof(bin_reader_t));
+    r->fp = fopen(f, "r");
+    if (r->fp == NULL) {
+        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
+        exit(EXIT_FAILURE);
+    }
+    if (fstat(fileno(r->fp), &st) == 0 && S_ISREG(st.st_mode)) {
+        r->seekable = 1;
+        if (st.st_size > 0) {
+            r->map = (uint8_t *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(r->fp), 0);
+            if (r->map == MAP_FAILED) {
+                r->map = 0;
+            } else {
+                r->size = st.st_size;
+                madvise(r->map, r->size, MADV_SEQUENTIAL);
+                madvise(r->map, r->size, MADV_WILLNEED);
+            }
+        }
+    }
+    if (r->map == NULL) {
+        r->m_io = BIN_IO_SIZE;
+        r->io = (uint8_t *) malloc(r->m_io);
+    }
+    r->min_q = mq;
+    r->w = 4;
+    r->end = UINT64_MAX;
+    r->out = (uint32_t *) malloc(BIN_BLOCK_SIZE * 4 * sizeof(uint32_t));
+
+    magic = bin_get(r, 4, &k);
+    if (k != 4 || memcmp(magic, BIN_MAGIC, 4)) {
+        // legacy headerless file, sequence ids are taken as they are
+        r->off -= k;
+        if (r->map == NULL)
+            r->i_io -= k;
+        r->buf = (uint32_t *) malloc(BIN_BLOCK_SIZE * 4 * sizeof(uint32_t));
+        return r;
+    }
+
+    bin_read_header(r, &r->ver, sizeof(uint32_t));
+    if (r->ver > BIN_VERSION) {
+        fprintf(stderr, "[E::%s] unsupported BIN file version %d\n", __func__, r->ver);
+        exit(EXIT_FAILURE);
+    }
+    bin_read_header(r, &r->flags, sizeof(uint32_t));
+    if (r->flags & ~(uint32_t) (BIN_FLAG_QUAL | BIN_FLAG_BLOCK | BIN_FLAG_SORTED)) {
+        fprintf(stderr, "[E::%s] unsupported BIN file flags 0x%x\n", __func__, r->flags);
+        exit(EXIT_FAILURE);
+    }
+    if (r->flags & BIN_FLAG_QUAL)
+        r->w = 5;
+    bin_read_header(r, &r->mq, sizeof(uint32_t));
+    bin_read_header(r, &r->n_rec, sizeof(uint64_t));
+    if (r->flags & BIN_FLAG_SORTED) {
+        bin_read_header(r, &r->idx_off, sizeof(uint64_t));
+        r->end = r->idx_off;
+    }
+    bin_read_header(r, &r->n_seq, sizeof(uint32_t));
+    r->name = (char **) malloc(r->n_seq * sizeof(char *));
+    r->len = (uint32_t *) malloc(r->n_seq * sizeof(uint32_t));
+    for (i = 0; i < r->n_seq; ++i) {
+        bin_read_header(r, &l, sizeof(uint32_t));
+        r->name[i] = (char *) malloc(l + 1);
+        bin_read_header(r, r->name[i], l);
+        r->name[i][l] = '\0';
+        bin_read_header(r, &r->len[i], sizeof(uint32_t));
+    }
+
+    if (dict) {
+        r->id_map = (uint32_t *) malloc(r->n_seq * sizeof(uint32_t));
+        for (i = 0; i < r->n_seq; ++i) {
+            id = sd_get(dict, r->name[i]);
+            if (id != UINT32_MAX && dict->s[id].len != r->len[i]) {
+                fprintf(stderr, "[E::%s] sequence \"%s\" length mismatch: %u in BIN file, %u in FASTA index\n", __func__, r->name[i], r->len[i], dict->s[id].len);
+                exit(EXIT_FAILURE);
+            }
+            r->id_map[i] = id;
+        }
+        // sequences in the same order as the dictionary need no mapping
+        for (i = 0; i < r->n_seq && r->id_map[i] == i; ++i);
+        if (i == r->n_seq && r->n_seq == dict->n) {
+            free(r->id_map);
+            r->id_map = 0;
+        }
+    }
+    if (r->flags & BIN_FLAG_BLOCK)
+        r->blk = (bin_rec_t *) malloc(BIN_BLOCK_SIZE * sizeof(bin_rec_t));
+    else
+        r->buf = (uint32_t *) malloc(BIN_BLOCK_SIZE * r->w * sizeof(uint32_t));
+
+    return r;
+}
+
+// read intra-sequence pairs only, other blocks of a sorted file are skipped with the index
+void bin_reader_intra(bin_reader_t *r)
+{
+    const uint8_t *p;
+    uint64_t idx[3];
+    uint32_t i;
+    size_t l;
+
+    r->intra = 1;
+    if (!(r->flags & BIN_FLAG_SORTED) || !r->seekable)
+        return;
+
+    bin_seek(r, r->idx_off);
+    r->rng = (uint64_t *) malloc((size_t) r->n_seq * 2 * sizeof(uint64_t));
+    r->n_rng = r->i_rng = 0;
+    for (i = 0; i < r->n_seq; ++i) {
+        p = bin_get(r, sizeof(idx), &l);
+        if (l != sizeof(idx)) {
+            fprintf(stderr, "[E::%s] truncated BIN file index\n", __func__);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(idx, p, sizeof(idx));
+        // sequences absent from the dictionary have no pairs to read
+        if (idx[0] == idx[1] || (r->id_map && r->id_map[i] == UINT32_MAX))
+            continue;
+        r->rng[r->n_rng * 2] = idx[0];
+        r->rng[r->n_rng * 2 + 1] = idx[1];
+        ++r->n_rng;
+    }
+    bin_seek(r, r->n_rng? r->rng[0] : r->end);
+}
+
+void bin_reader_close(bin_reader_t *r)
+{
+    uint32_t i;
+    for (i = 0; i < r->n_seq; ++i)
+        free(r->name[i]);
+    free(r->name);
+    free(r->len);
+    free(r->id_map);
+    free(r->buf);
+    free(r->blk);
+    free(r->out);
+    free(r->io);
+    free(r->rng);
+    if (r->map)
+        munmap(r->map, r->size);
+    fclose(r->fp);
+    free(r);
+}
+
+static void bin_block_error(const char *func)
+{
+    fprintf(stderr, "[E::%s] corrupted BIN block\n", func);
+    exit(EXIT_FAILURE);
+}
+
+// hand out the encoded bytes of the next block, return the number of records, 0 at the end of file
+// the bytes are valid until the next call, or as long as the reader if the file is memory-mapped
+uint32_t bin_read_block_data(bin_reader_t *r, const uint8_t **data, uint32_t *size)
+{
+    uint32_t hdr[2];
+    const uint8_t *p;
+    size_t l;
+
+    if (r->rng) {
+        // move on to the next range of blocks
+        while (r->i_rng < r->n_rng && r->off >= r->rng[r->i_rng * 2 + 1])
+            if (++r->i_rng < r->n_rng)
+                bin_seek(r, r->rng[r->i_rng * 2]);
+        if (r->i_rng == r->n_rng)
+            return 0;
+    }
+    if (r->off >= r->end)
+        return 0;
+
+    p = bin_get(r, sizeof(hdr), &l);
+    if (l == 0)
+        return 0;
+    if (l != sizeof(hdr)) {
+        fprintf(stderr, "[W::%s] truncated BIN block\n", __func__);
+        return 0;
+    }
+    memcpy(hdr, p, sizeof(hdr));
+    if (hdr[0] > BIN_BLOCK_SIZE)
+        bin_block_error(__func__);
+    p = bin_get(r, hdr[1], &l);
+    if (l != hdr[1]) {
+        fprintf(stderr, "[W::%s] truncated BIN block\n", __func__);
+        return 0;
+    }
+    *data = p;
+    *size = hdr[1];
+
+    return hdr[0];
+}
+
+// decode the n records of a block of size bytes
+static void bin_decode_block(const bin_reader_t *r, const uint8_t *p, uint32_t size, uint32_t n_rec, bin_rec_t *blk)
+{
+    uint32_t i, k, n, i0, p0;
+    uint64_t x, y;
+    const uint8_t *end;
+    bin_rec_t *rec;
+
+    end = p + size;
+    i0 = 0;
+    for (k = 0; k < n_rec; ) {
+        if (!(p = get_varint(p, end, &x)) || !(p = get_varint(p, end, &y)) || y == 0 || y > n_rec - k)
+            bin_block_error(__func__);
+        i0 += x;
+        n = y;
+        for (i = 0, p0 = 0; i < n; ++i, ++k) {
+            rec = &blk[k];
+            if (!(p = get_varint(p, end, &x)))
+                bin_block_error(__func__);
+            rec->i0 = i0;
+            rec->p0 = p0 += x;
+            if (!(p = get_varint(p, end, &x)) || !(p = get_varint(p, end, &y)))
+                bin_block_error(__func__);
+            rec->i1 = i0 + (x >> 1);
+            rec->p1 = rec->i1 == i0? (uint32_t) ((int64_t) p0 + unzigzag(y)) : y;
+            rec->qd = (x & 1) << 16;
+            if (r->flags & BIN_FLAG_QUAL) {
+                if (p + 2 > end)
+                    bin_block_error(__func__);
+                rec->qd |= (uint32_t) p[0] | (uint32_t) p[1] << 8;
+                p += 2;
+            }
+        }
+    }
+}
+
+// read and decode the next block, return the number of records, 0 at the end of file
+static uint32_t bin_read_block(bin_reader_t *r)
+{
+    uint32_t n, l;
+    const uint8_t *p;
+
+    n = bin_read_block_data(r, &p, &l);
+    if (n > 0)
+        bin_decode_block(r, p, l, n, r->blk);
+    return n;
+}
+
+// copy the records passing the filters to out with sequence ids mapped, return the number of values copied
+static uint32_t bin_filter_recs(const bin_reader_t *r, const uint32_t *a, uint32_t m, uint32_t w, uint32_t *out)
+{
+    uint32_t i, j, i0, i1, p0, p1, qd;
+
+    for (i = j = 0; i < m; i += w) {
+        if (r->intra && a[i] != a[i + 2])
+            continue;
+        if (w == 5) {
+            qd = a[i + 4];
+            if (qd >> 16 & 1)
+                continue;
+            if ((r->flags & BIN_FLAG_QUAL) && ((qd & 0xff) < r->min_q || (qd >> 8 & 0xff) < r->min_q))
+                continue;
+        }
+        i0 = a[i];
+        i1 = a[i + 2];
+        p0 = a[i + 1];
+        p1 = a[i + 3];
+        if (r->n_seq && (i0 >= r->n_seq || i1 >= r->n_seq)) {
+            fprintf(stderr, "[E::%s] invalid sequence id in BIN file\n", __func__);
+            exit(EXIT_FAILURE);
+        }
+        if (r->id_map) {
+            i0 = r->id_map[i0];
+            i1 = r->id_map[i1];
+            if (i0 == UINT32_MAX || i1 == UINT32_MAX)
+                continue;
+            if (i0 > i1) {
+                SWAP(uint32_t, i0, i1);
+                SWAP(uint32_t, p0, p1);
+            }
+        }
+        out[j] = i0;
+        out[j + 1] = p0;
+        out[j + 2] = i1;
+        out[j + 3] = p1;
+        j += 4;
+    }
+
+    return j;
+}
+
+// hand out the next span of records (id0, pos0, id1, pos1), return the number of values, 0 at the end of file
+// the span is valid until the next call; records of sequences absent from the dictionary or not passing the filters are skipped
+// a span points into the file itself only for a mapped file without qualities (legacy or dumped without them)
+// whose sequences are in the order of the dictionary and with all pairs read; other spans are copies
+uint32_t bin_read_pairs(bin_reader_t *r, const uint32_t **a)
+{
+    uint32_t j, m, w, rw;
+    const uint8_t *p;
+    size_t l;
+
+    if (r->flags & BIN_FLAG_BLOCK) {
+        while ((m = bin_read_block(r)) > 0)
+            if ((j = bin_filter_recs(r, (uint32_t *) r->blk, m * 5, 5, r->out)) > 0) {
+                *a = r->out;
+                return j;
+            }
+        return 0;
+    }
+
+    w = r->w;
+    rw = w * sizeof(uint32_t);
+    while (1) {
+        p = bin_get(r, (size_t) BIN_BLOCK_SIZE * rw, &l);
+        if (l % rw) {
+            fprintf(stderr, "[W::%s] truncated BIN record\n", __func__);
+            l -= l % rw;
+        }
+        if (l == 0)
+            return 0;
+        m = l / sizeof(uint32_t);
+        if ((uintptr_t) p % sizeof(uint32_t)) {
+            memcpy(r->buf, p, l);
+            p = (const uint8_t *) r->buf;
+        }
+        if (w == 4 && r->id_map == NULL && !r->intra) {
+            *a = (const uint32_t *) p;
+            return m;
+        }
+        if ((j = bin_filter_recs(r, (const uint32_t *) p, m, w, r->out)) > 0) {
+            *a = r->out;
+            return j;
+        }
+    }
+
+    return 0;
+}
+
+// decode a block from bin_read_block_data into the records (id0, pos0, id1, pos1) passing the filters,
+// return the number of values; blk holds BIN_BLOCK_SIZE records and out BIN_BLOCK_SIZE * 4 values
+// the reader is not changed, so blocks can be decoded by multiple threads
+uint32_t bin_decode_pairs(const bin_reader_t *r, const uint8_t *data, uint32_t size, uint32_t n_rec, bin_rec_t *blk, uint32_t *out)
+{
+    bin_decode_block(r, data, size, n_rec, blk);
+    return bin_filter_recs(r, (uint32_t *) blk, n_rec * 5, 5, out);
+}
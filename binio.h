@@ -0,0 +1,134 @@
+/*********************************************************************************
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2021 Chenxi Zhou <chnx.zhou@gmail.com>                          *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in    *
+ * all copies or substantial portions of the Software.                           *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *********************************************************************************/
+
+/********************************** Revision History *****************************
+ *                                                                               *
+ * 18/10/26 - agent: Created                                                     *
+ *                                                                               *
+ *********************************************************************************/
+#ifndef BINIO_H_
+#define BINIO_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sdict.h"
+#include "asset.h"
+
+/* BIN file layout (little-endian)
+ *   magic "YHSB", uint32 version, uint32 flags, uint32 min mapq at dump time
+ *   uint64 number of records, uint64 offset of the index if BIN_FLAG_SORTED is set
+ *   uint32 number of sequences, then for each sequence uint32 name length, name, uint32 sequence length
+ *   records of four uint32 (id0, pos0, id1, pos1) with id0 <= id1,
+ *   followed by a fifth uint32 (mapq0 | mapq1 << 8 | dup << 16) if BIN_FLAG_QUAL is set
+ * if BIN_FLAG_BLOCK is set, records are stored in independently decodable blocks instead
+ *   uint32 number of records, uint32 number of bytes, then the records sorted by (id0, pos0)
+ *   in groups of the same id0: varint id0 delta, varint group size, and for each record
+ *   varint pos0 delta, varint (id1 - id0) << 1 | dup, varint zigzag(pos1 - pos0) if id1 == id0
+ *   or pos1 otherwise, and mapq0 and mapq1 bytes if BIN_FLAG_QUAL is set
+ * if BIN_FLAG_SORTED is set, blocks are sorted by (id0, id1), a block holds either intra or inter
+ *   pairs of a single id0, and the index after the last block gives for each sequence the offsets
+ *   of its first block, its first inter block and the end of its blocks as three uint64
+ * a file not starting with the magic is a legacy headerless stream of records
+ */
+#define BIN_MAGIC "YHSB"
+#define BIN_VERSION 1
+
+#define BIN_FLAG_QUAL 0x1 // records carry mapping qualities and the duplicate flag
+#define BIN_FLAG_BLOCK 0x2 // records are delta/varint encoded in blocks
+#define BIN_FLAG_SORTED 0x4 // blocks are sorted by sequence pair and indexed
+
+#define BIN_BLOCK_SIZE 65536 // maximum number of records per block, and per span handed out by the reader
+#define BIN_IO_SIZE (1 << 24) // read buffer size if the file cannot be memory-mapped
+
+typedef struct {
+    uint32_t i0, p0, i1, p1;
+    uint32_t qd; // mapq0 | mapq1 << 8 | dup << 16
+} bin_rec_t;
+
+typedef struct {
+    FILE *fp;
+    uint32_t flags, w; // w: words per record
+    uint64_t n_rec;
+    long rec_off; // file offset of the record count
+    uint32_t n, buf[BUFF_SIZE];
+    uint32_t n_blk; // records in the current block
+    bin_rec_t *blk;
+    uint8_t *data; // encoded block
+    // sorted output
+    uint32_t n_seq;
+    long idx_off; // file offset of the index offset
+    uint64_t blk_off; // file offset of the first block
+    uint64_t *idx; // first block, first inter block and end of blocks of each sequence
+    size_t n_srt, m_srt;
+    bin_rec_t *srt; // records to sort
+    char *tmp; // prefix of sorted run files
+    int n_run;
+    FILE **run; // sorted runs
+} bin_writer_t;
+
+typedef struct {
+    FILE *fp;
+    uint8_t *map; // memory-mapped file, NULL if read through fp
+    uint64_t size; // size of the mapped file
+    int seekable;
+    uint8_t *io; // read buffer for unmapped files
+    size_t l_io, i_io, m_io;
+    int ver; // 0 for legacy files
+    uint32_t flags, mq, w; // w: words per record
+    uint8_t min_q; // records with a mate below the mapping quality are skipped if BIN_FLAG_QUAL is set
+    uint64_t n_rec;
+    uint32_t n_seq; // sequences in the header
+    char **name;
+    uint32_t *len;
+    uint32_t *id_map; // BIN sequence id -> dictionary id, UINT32_MAX if absent
+    uint32_t *buf; // unaligned records copied
+    bin_rec_t *blk; // decoded block
+    uint32_t *out; // records handed out
+    uint64_t off, end; // current file offset and end of records
+    uint64_t idx_off; // file offset of the index if BIN_FLAG_SORTED is set
+    int intra; // intra-sequence pairs only
+    uint32_t n_rng, i_rng;
+    uint64_t *rng; // file ranges of blocks to read
+} bin_reader_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bin_writer_t *bin_writer_open(const char *f, sdict_t *dict, uint8_t mq, uint32_t flags, long max_mem);
+void bin_write_pair(bin_writer_t *w, uint32_t i0, uint32_t p0, uint32_t i1, uint32_t p1, uint8_t q0, uint8_t q1, uint8_t dup);
+void bin_writer_close(bin_writer_t *w);
+bin_reader_t *bin_reader_open(const char *f, sdict_t *dict, uint8_t mq);
+void bin_reader_intra(bin_reader_t *r);
+uint32_t bin_read_pairs(bin_reader_t *r, const uint32_t **a);
+uint32_t bin_read_block_data(bin_reader_t *r, const uint8_t **data, uint32_t *size);
+uint32_t bin_decode_pairs(const bin_reader_t *r, const uint8_t *data, uint32_t size, uint32_t n_rec, bin_rec_t *blk, uint32_t *out);
+void bin_reader_close(bin_reader_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BINIO_H_ */
@@ -36,6 +36,7 @@
 
 #include "sdict.h"
 #include "break.h"
+#include "binio.h"
 #include "asset.h"
 
 #undef DEBUG
@@ -78,14 +79,17 @@ void link_mat_destroy(link_mat_t *link_mat)
     free(link_mat);
 }
 
-uint32_t estimate_dist_thres_from_file(const char *f, asm_dict_t *dict, double min_frac, uint32_t resolution)
+uint32_t estimate_dist_thres_from_file(const char *f, asm_dict_t *dict, double min_frac, uint32_t resolution, uint8_t mq)
 {
     uint32_t i;
-    FILE *fp;
+    bin_reader_t *fp;
     long pair_c, intra_c, cum_c;
     uint64_t max_len;
     uint32_t nb, *link_c;
-    uint32_t buffer[BUFF_SIZE], m, i0, i1;
+    const uint32_t *buffer;
+    uint32_t *sid;
+    uint64_t *spos;
+    uint32_t m, i0, i1;
     uint64_t p0, p1;
 
     max_len = 0;
@@ -95,34 +99,33 @@ uint32_t estimate_dist_thres_from_file(const char *f, asm_dict_t *dict, double m
     nb = div_ceil(max_len, resolution);
     link_c = (uint32_t *) calloc(nb, sizeof(uint32_t));
 
-    fp = fopen(f, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
-        exit(EXIT_FAILURE);
-    }
+    fp = bin_reader_open(f, dict->sdict, mq);
+    // skip inter-sequence pairs if no scaffold joins sequences
+    if (asm_single_seq_scaffolds(dict))
+        bin_reader_intra(fp);
 
     pair_c = 0;
     intra_c = 0;
-    while (1) {
-        m = fread(&buffer, sizeof(uint32_t), BUFF_SIZE, fp);
+    sid = (uint32_t *) malloc(BIN_BLOCK_SIZE * 2 * sizeof(uint32_t));
+    spos = (uint64_t *) malloc(BIN_BLOCK_SIZE * 2 * sizeof(uint64_t));
+    while ((m = bin_read_pairs(fp, &buffer)) > 0) {
+        sd_coordinate_conversion_pairs(dict, buffer, m / 4, sid, spos, 0);
         for (i = 0; i < m; i += 4) {
-            sd_coordinate_conversion(dict, buffer[i], buffer[i + 1], &i0, &p0, 0);
-            sd_coordinate_conversion(dict, buffer[i + 2], buffer[i + 3], &i1, &p1, 0);
+            i0 = sid[i / 2];
+            p0 = spos[i / 2];
+            i1 = sid[i / 2 + 1];
+            p1 = spos[i / 2 + 1];
             if (i0 == i1) {
                 ++link_c[labs((long) p0 - p1) / resolution];
                 ++intra_c;
             }
         }
         pair_c += m / 4;
-
-        if (m < BUFF_SIZE) {
-            if (ferror(fp))
-                return 0;
-            break;
-        }
     }
     
-    fclose(fp);
+    bin_reader_close(fp);
+    free(sid);
+    free(spos);
     
     i = 0;
     cum_c = 0;
@@ -176,20 +179,9 @@ static void calc_moving_average(int64_t *arr, int32_t n, int32_t a)
     free(buff);
 }
 
-link_mat_t *link_mat_from_file(const char *f, asm_dict_t *dict, uint32_t dist_thres, uint32_t resolution, double noise, uint32_t move_avg)
+static link_mat_t *link_mat_alloc(asm_dict_t *dict, uint32_t resolution)
 {
-    FILE *fp;
-    uint32_t i, j, n;
-    uint32_t buffer[BUFF_SIZE], m, i0, i1;
-    uint64_t p0, p1;
-    long pair_c, intra_c;
-
-    fp = fopen(f, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
-        exit(EXIT_FAILURE);
-    }
-
+    uint32_t i, n;
     link_mat_t *link_mat = (link_mat_t *) malloc(sizeof(link_mat_t));
     link_mat->b = resolution;
     link_mat->n = dict->n;
@@ -200,36 +192,12 @@ link_mat_t *link_mat_from_file(const char *f, asm_dict_t *dict, uint32_t dist_th
         link_mat->link[i].n = n;
         link_mat->link[i].link = (int64_t *) calloc(n, sizeof(int64_t));
     }
+    return link_mat;
+}
 
-    pair_c = intra_c = 0;
-    while (1) {
-        m = fread(&buffer, sizeof(uint32_t), BUFF_SIZE, fp);
-        for (i = 0; i < m; i += 4) {
-            sd_coordinate_conversion(dict, buffer[i], buffer[i + 1], &i0, &p0, 0);
-            sd_coordinate_conversion(dict, buffer[i + 2], buffer[i + 3], &i1, &p1, 0);
-
-            if (p0 > p1)
-                SWAP(uint64_t, p0, p1);
-            if (i0 == i1 && p1 - p0 <= dist_thres) {
-                ++intra_c;
-                link_mat->link[i0].link[(MAX(p0, 1) - 1) / resolution] += 1;
-                link_mat->link[i1].link[(MAX(p1, 1) - 1) / resolution] -= 1;
-            }
-        }
-        pair_c += m / 4;
-
-        if (m < BUFF_SIZE) {
-            if (ferror(fp))
-                return 0;
-            break;
-        }
-    }
-    fclose(fp);
-
-#ifdef DEBUG
-    printf("[I::%s] %ld read pairs processed, intra links: %ld \n", __func__, pair_c, intra_c);
-#endif
-    
+static void link_mat_finalise(link_mat_t *link_mat, uint32_t dist_thres, uint32_t resolution, double noise, uint32_t move_avg)
+{
+    uint32_t i, j, n;
     int64_t *link;
     for (i = 0; i < link_mat->n; ++i) {
         link = link_mat->link[i].link;
@@ -262,11 +230,181 @@ link_mat_t *link_mat_from_file(const char *f, asm_dict_t *dict, uint32_t dist_th
         for (j = 0; j < n; ++j)
             link_c[j] |= (int64_t) j << 32;
     }
+}
+
+link_mat_t *link_mat_from_file(const char *f, contact_cache_t *cc, asm_dict_t *dict, uint32_t dist_thres, uint32_t resolution, double noise, uint32_t move_avg, uint8_t mq)
+{
+    bin_reader_t *fp;
+    uint32_t i, w;
+    uint64_t ci;
+    const uint32_t *buffer, *cnt;
+    uint32_t *sid;
+    uint64_t *spos;
+    uint32_t m, i0, i1;
+    uint64_t p0, p1;
+    long pair_c, intra_c;
+
+    fp = cc? 0 : bin_reader_open(f, dict->sdict, mq);
+    if (fp && asm_single_seq_scaffolds(dict))
+        bin_reader_intra(fp);
+
+    link_mat_t *link_mat = link_mat_alloc(dict, resolution);
+
+    pair_c = intra_c = 0;
+    ci = 0;
+    cnt = 0;
+    sid = (uint32_t *) malloc(BIN_BLOCK_SIZE * 2 * sizeof(uint32_t));
+    spos = (uint64_t *) malloc(BIN_BLOCK_SIZE * 2 * sizeof(uint64_t));
+    while ((m = cc? contact_cache_read(cc, &ci, &buffer, &cnt) : bin_read_pairs(fp, &buffer)) > 0) {
+        sd_coordinate_conversion_pairs(dict, buffer, m / 4, sid, spos, 0);
+        for (i = 0; i < m; i += 4) {
+            i0 = sid[i / 2];
+            p0 = spos[i / 2];
+            i1 = sid[i / 2 + 1];
+            p1 = spos[i / 2 + 1];
+
+            if (p0 > p1)
+                SWAP(uint64_t, p0, p1);
+            if (i0 == i1 && p1 - p0 <= dist_thres) {
+                w = cnt? cnt[i / 4] : 1;
+                intra_c += w;
+                link_mat->link[i0].link[(MAX(p0, 1) - 1) / resolution] += w;
+                link_mat->link[i1].link[(MAX(p1, 1) - 1) / resolution] -= w;
+            }
+        }
+        pair_c += m / 4;
+    }
+    if (fp)
+        bin_reader_close(fp);
+    free(sid);
+    free(spos);
+
+#ifdef DEBUG
+    printf("[I::%s] %ld read pairs processed, intra links: %ld \n", __func__, pair_c, intra_c);
+#endif
+    
+    link_mat_finalise(link_mat, dist_thres, resolution, noise, move_avg);
     
     return link_mat;
 }
 
-// sort by position = higher 32 bits
+// estimate_dist_thres_from_file and link_mat_from_file in a single pass
+// dist_thres is at least min_thres so pairs within min_thres are added straight away
+// pairs further apart are buffered until dist_thres is known, or rescanned if over max_mem
+link_mat_t *link_mat_from_file_est_dist_thres(const char *f, contact_cache_t *cc, asm_dict_t *dict, double min_frac, uint32_t min_thres, uint32_t dist_resolution, uint32_t resolution, uint32_t move_avg, uint8_t mq, long max_mem, uint32_t *dist_thres)
+{
+    uint32_t i;
+    bin_reader_t *fp;
+    long pair_c, intra_c, cum_c;
+    uint64_t max_len, far_n, far_m, far_max;
+    uint32_t nb, w, *link_c, *far;
+    uint64_t ci;
+    const uint32_t *buffer, *cnt;
+    uint32_t *sid;
+    uint64_t *spos;
+    uint32_t m, i0, i1;
+    uint64_t p0, p1, j;
+
+    max_len = 0;
+    for (i = 0; i < dict->n; ++i)
+        if (dict->s[i].len > max_len)
+            max_len = dict->s[i].len;
+    nb = div_ceil(max_len, dist_resolution);
+    link_c = (uint32_t *) calloc(nb, sizeof(uint32_t));
+
+    // far pairs are kept as [seq id, pos0, pos1]
+    // cached cells are cheap to go through again so they are not buffered
+    far_n = 0;
+    far_max = !cc && max_len <= UINT32_MAX && max_mem > 0? max_mem / (3 * sizeof(uint32_t)) : 0;
+    far_m = MIN(far_max, 1 << 16);
+    far = far_m? (uint32_t *) malloc(far_m * 3 * sizeof(uint32_t)) : 0;
+
+    fp = cc? 0 : bin_reader_open(f, dict->sdict, mq);
+    if (fp && asm_single_seq_scaffolds(dict))
+        bin_reader_intra(fp);
+
+    link_mat_t *link_mat = link_mat_alloc(dict, resolution);
+
+    pair_c = 0;
+    intra_c = 0;
+    ci = 0;
+    cnt = 0;
+    sid = (uint32_t *) malloc(BIN_BLOCK_SIZE * 2 * sizeof(uint32_t));
+    spos = (uint64_t *) malloc(BIN_BLOCK_SIZE * 2 * sizeof(uint64_t));
+    while ((m = cc? contact_cache_read(cc, &ci, &buffer, &cnt) : bin_read_pairs(fp, &buffer)) > 0) {
+        sd_coordinate_conversion_pairs(dict, buffer, m / 4, sid, spos, 0);
+        for (i = 0; i < m; i += 4) {
+            i0 = sid[i / 2];
+            p0 = spos[i / 2];
+            i1 = sid[i / 2 + 1];
+            p1 = spos[i / 2 + 1];
+            if (i0 != i1)
+                continue;
+            w = cnt? cnt[i / 4] : 1;
+            link_c[labs((long) p0 - p1) / dist_resolution] += w;
+            intra_c += w;
+
+            if (p0 > p1)
+                SWAP(uint64_t, p0, p1);
+            if (p1 - p0 <= min_thres) {
+                link_mat->link[i0].link[(MAX(p0, 1) - 1) / resolution] += w;
+                link_mat->link[i1].link[(MAX(p1, 1) - 1) / resolution] -= w;
+            } else if (far) {
+                if (far_n == far_m) {
+                    if (far_m >= far_max) {
+                        free(far);
+                        far = 0;
+                        continue;
+                    }
+                    far_m = MIN(far_max, far_m << 1);
+                    far = (uint32_t *) realloc(far, far_m * 3 * sizeof(uint32_t));
+                }
+                far[far_n * 3] = i0;
+                far[far_n * 3 + 1] = p0;
+                far[far_n * 3 + 2] = p1;
+                ++far_n;
+            }
+        }
+        pair_c += m / 4;
+    }
+    if (fp)
+        bin_reader_close(fp);
+    free(sid);
+    free(spos);
+
+    i = 0;
+    cum_c = 0;
+    while (cum_c < intra_c * min_frac)
+        cum_c += link_c[i++];
+    free(link_c);
+    *dist_thres = MAX(i * dist_resolution, min_thres);
+
+#ifdef DEBUG
+    printf("[I::%s] %ld read pairs processed, intra links: %ld \n", __func__, pair_c, intra_c);
+#endif
+
+    if (!far) {
+        // far pairs not buffered or do not fit in memory
+        link_mat_destroy(link_mat);
+        return link_mat_from_file(f, cc, dict, *dist_thres, resolution, .0, move_avg, mq);
+    }
+
+    for (j = 0; j < far_n; ++j) {
+        i0 = far[j * 3];
+        p0 = far[j * 3 + 1];
+        p1 = far[j * 3 + 2];
+        if (p1 - p0 <= *dist_thres) {
+            link_mat->link[i0].link[(MAX(p0, 1) - 1) / resolution] += 1;
+            link_mat->link[i0].link[(MAX(p1, 1) - 1) / resolution] -= 1;
+        }
+    }
+    free(far);
+
+    link_mat_finalise(link_mat, *dist_thres, resolution, .0, move_avg);
+
+    return link_mat;
+}
+
 int pos_cmp(const void *p, const void *q)
 {
     int64_t d = *(int64_t *) p - *(int64_t *) q;
@@ -33,6 +33,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include "sdict.h"
+#include "contact.h"
 
 #define SQRT2 1.41421356237
 #define SQRT2_2 .70710678118
@@ -60,8 +61,9 @@ extern "C" {
 
 link_t *link_init(uint32_t s, uint32_t n);
 link_mat_t *link_mat_init(asm_dict_t *dict, uint32_t b);
-link_mat_t *link_mat_from_file(const char *f, asm_dict_t *dict, uint32_t dist_thres, uint32_t resolution, double noise, uint32_t move_avg);
-uint32_t estimate_dist_thres_from_file(const char *f, asm_dict_t *dict, double min_frac, uint32_t resolution);
+link_mat_t *link_mat_from_file(const char *f, contact_cache_t *cc, asm_dict_t *dict, uint32_t dist_thres, uint32_t resolution, double noise, uint32_t move_avg, uint8_t mq);
+uint32_t estimate_dist_thres_from_file(const char *f, asm_dict_t *dict, double min_frac, uint32_t resolution, uint8_t mq);
+link_mat_t *link_mat_from_file_est_dist_thres(const char *f, contact_cache_t *cc, asm_dict_t *dict, double min_frac, uint32_t min_thres, uint32_t dist_resolution, uint32_t resolution, uint32_t move_avg, uint8_t mq, long max_mem, uint32_t *dist_thres);
 void link_mat_destroy(link_mat_t *link_mat);
 void print_link_mat(link_mat_t *link_mat, asm_dict_t *dict, FILE *fp);
 bp_t *detect_break_points(link_mat_t *link_mat, uint32_t bin_size, uint32_t merge_size, double fold_thres, uint32_t dual_break_thres, uint32_t *bp_n);
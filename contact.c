@@ -0,0 +1,168 @@
+/*********************************************************************************
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2021 Chenxi Zhou <chnx.zhou@gmail.com>                          *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in    *
+ * all copies or substantial portions of the Software.                           *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *********************************************************************************/
+
+/********************************** Revision History *****************************
+ *                                                                               *
+ * 18/10/26 - agent: Created                                                     *
+ *                                                                               *
+ *********************************************************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ksort.h"
+#include "contact.h"
+
+#undef DEBUG
+
+typedef struct {
+    uint64_t x, y; // id0 << 32 | bin0, id1 << 32 | bin1
+    uint32_t c;
+} cc_cell_t;
+
+#define cc_cell_lt(a, b) ((a).x < (b).x || ((a).x == (b).x && (a).y < (b).y))
+KSORT_INIT(cc_cell, cc_cell_t, cc_cell_lt)
+
+static uint64_t cc_cell_compact(cc_cell_t *a, uint64_t n)
+{
+    uint64_t i, k;
+    if (n == 0)
+        return 0;
+    ks_introsort_cc_cell(n, a);
+    for (i = 1, k = 0; i < n; ++i) {
+        if (a[i].x == a[k].x && a[i].y == a[k].y)
+            a[k].c += a[i].c;
+        else
+            a[++k] = a[i];
+    }
+    return k + 1;
+}
+
+static inline uint32_t bin_mid(uint32_t k, uint32_t b, uint32_t len)
+{
+    uint64_t s, e;
+    s = (uint64_t) k * b + 1;
+    e = MIN((uint64_t) (k + 1) * b, len);
+    return (s + e) / 2;
+}
+
+// return 0 if the cells would take more than max_mem bytes at any point, max_mem < 0 for no limit
+contact_cache_t *contact_cache_from_file(const char *f, sdict_t *dict, uint8_t mq, uint32_t b, long max_mem)
+{
+    uint32_t i, m;
+    uint64_t j, n, n_cell, m_cell, n_pair, x, y;
+    const uint32_t *buffer;
+    cc_cell_t *cell;
+    bin_reader_t *fp;
+    contact_cache_t *cc;
+
+    fp = bin_reader_open(f, dict, mq);
+
+    n_cell = n_pair = 0;
+    m_cell = 1 << 20;
+    cell = (cc_cell_t *) malloc(m_cell * sizeof(cc_cell_t));
+    while ((m = bin_read_pairs(fp, &buffer)) > 0) {
+        if (n_cell + m / 4 > m_cell) {
+            n_cell = cc_cell_compact(cell, n_cell);
+            // grow if compaction did not free at least half of the space
+            if (n_cell + m / 4 > m_cell / 2) {
+                m_cell <<= 1;
+                if (max_mem >= 0 && m_cell * sizeof(cc_cell_t) > (uint64_t) max_mem)
+                    goto no_mem;
+                cell = (cc_cell_t *) realloc(cell, m_cell * sizeof(cc_cell_t));
+            }
+        }
+        for (i = 0; i < m; i += 4) {
+            x = (uint64_t) buffer[i] << 32 | (MAX(buffer[i + 1], 1) - 1) / b;
+            y = (uint64_t) buffer[i + 2] << 32 | (MAX(buffer[i + 3], 1) - 1) / b;
+            if (x > y)
+                SWAP(uint64_t, x, y);
+            cell[n_cell].x = x;
+            cell[n_cell].y = y;
+            cell[n_cell].c = 1;
+            ++n_cell;
+        }
+        n_pair += m / 4;
+    }
+    bin_reader_close(fp);
+    n_cell = cc_cell_compact(cell, n_cell);
+
+    n = n_cell;
+    // the cells are copied into the final arrays
+    if (max_mem >= 0 && m_cell * sizeof(cc_cell_t) + n * 5 * sizeof(uint32_t) > (uint64_t) max_mem) {
+        free(cell);
+        return 0;
+    }
+    cc = (contact_cache_t *) malloc(sizeof(contact_cache_t));
+    cc->b = b;
+    cc->n = n;
+    cc->n_pair = n_pair;
+    cc->a = (uint32_t *) malloc(n * 4 * sizeof(uint32_t));
+    cc->c = (uint32_t *) malloc(n * sizeof(uint32_t));
+    for (j = 0; j < n; ++j) {
+        x = cell[j].x >> 32;
+        y = cell[j].y >> 32;
+        cc->a[j * 4] = x;
+        cc->a[j * 4 + 1] = bin_mid((uint32_t) cell[j].x, b, dict->s[x].len);
+        cc->a[j * 4 + 2] = y;
+        cc->a[j * 4 + 3] = bin_mid((uint32_t) cell[j].y, b, dict->s[y].len);
+        cc->c[j] = cell[j].c;
+    }
+    free(cell);
+
+#ifdef DEBUG
+    printf("[I::%s] %lu read pairs aggregated into %lu cells of %u bp\n", __func__, n_pair, n, b);
+#endif
+
+    return cc;
+
+no_mem:
+    bin_reader_close(fp);
+    free(cell);
+    return 0;
+}
+
+void contact_cache_destroy(contact_cache_t *cc)
+{
+    if (!cc)
+        return;
+    free(cc->a);
+    free(cc->c);
+    free(cc);
+}
+
+// next span of at most BIN_BLOCK_SIZE cells starting from cell *i
+// return the number of uint32 words in a, like bin_read_pairs
+uint32_t contact_cache_read(contact_cache_t *cc, uint64_t *i, const uint32_t **a, const uint32_t **c)
+{
+    uint64_t n;
+    if (*i >= cc->n)
+        return 0;
+    n = MIN(cc->n - *i, BIN_BLOCK_SIZE);
+    *a = cc->a + *i * 4;
+    *c = cc->c + *i;
+    *i += n;
+    return n * 4;
+}
@@ -0,0 +1,62 @@
+/*********************************************************************************
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2021 Chenxi Zhou <chnx.zhou@gmail.com>                          *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in    *
+ * all copies or substantial portions of the Software.                           *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *********************************************************************************/
+
+/********************************** Revision History *****************************
+ *                                                                               *
+ * 18/10/26 - agent: Created                                                     *
+ *                                                                               *
+ *********************************************************************************/
+#ifndef CONTACT_H_
+#define CONTACT_H_
+
+#include <stdint.h>
+
+#include "sdict.h"
+#include "binio.h"
+
+/* contact cache: read pairs of a BIN file aggregated into cells of (seq0, bin0, seq1, bin1)
+ * cells are kept in BIN record layout with each read placed at the middle of its bin,
+ * so the matrix builders treat them as read pairs weighted by the cell count
+ */
+typedef struct {
+    uint32_t b; // bin size
+    uint64_t n; // number of cells
+    uint32_t *a; // cells [4 x n]: id0, pos0, id1, pos1
+    uint32_t *c; // count of each cell [n]
+    uint64_t n_pair; // number of read pairs aggregated
+} contact_cache_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+contact_cache_t *contact_cache_from_file(const char *f, sdict_t *dict, uint8_t mq, uint32_t b, long max_mem);
+void contact_cache_destroy(contact_cache_t *cc);
+uint32_t contact_cache_read(contact_cache_t *cc, uint64_t *i, const uint32_t **a, const uint32_t **c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONTACT_H_ */
@@ -34,33 +34,36 @@
 #include "bamlite.h"
 #include "ketopt.h"
 #include "sdict.h"
+#include "pairs.h"
+#include "binio.h"
 #include "asset.h"
 
-KHASH_SET_INIT_STR(str)
-
-static int make_juicer_pre_file_from_bin(char *f, char *agp, char *fai, int scale, int count_gap, FILE *fo)
+static int make_juicer_pre_file_from_bin(char *f, char *agp, char *fai, uint8_t mq, int scale, int count_gap, FILE *fo)
 {
-    FILE *fp;
+    bin_reader_t *fp;
     uint32_t i, i0, i1;
     uint64_t p0, p1;
-    uint32_t buffer[BUFF_SIZE], m;
+    const uint32_t *buffer;
+    uint32_t *sid;
+    uint64_t *spos;
+    uint32_t m;
     long pair_c;
 
     sdict_t *sdict = make_sdict_from_index(fai, 0);
     asm_dict_t *dict = agp? make_asm_dict_from_agp(sdict, agp) : make_asm_dict_from_sdict(sdict);
 
-    fp = fopen(f, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
-        exit(EXIT_FAILURE);
-    }
+    fp = bin_reader_open(f, sdict, mq);
 
     pair_c = 0;
-    while (1) {
-        m = fread(&buffer, sizeof(uint32_t), BUFF_SIZE, fp);
+    sid = (uint32_t *) malloc(BIN_BLOCK_SIZE * 2 * sizeof(uint32_t));
+    spos = (uint64_t *) malloc(BIN_BLOCK_SIZE * 2 * sizeof(uint64_t));
+    while ((m = bin_read_pairs(fp, &buffer)) > 0) {
+        sd_coordinate_conversion_pairs(dict, buffer, m / 4, sid, spos, count_gap);
         for (i = 0; i < m; i += 4) {
-            sd_coordinate_conversion(dict, buffer[i], buffer[i + 1], &i0, &p0, count_gap);
-            sd_coordinate_conversion(dict, buffer[i + 2], buffer[i + 3], &i1, &p1, count_gap);
+            i0 = sid[i / 2];
+            p0 = spos[i / 2];
+            i1 = sid[i / 2 + 1];
+            p1 = spos[i / 2 + 1];
             if (i0 == UINT32_MAX || i1 == UINT32_MAX) {
                 fprintf(stderr, "[W::%s] sequence not found \n", __func__);
             } else {
@@ -71,245 +74,84 @@ static int make_juicer_pre_file_from_bin(char *f, char *agp, char *fai, int scal
             }
         }
         pair_c += m / 4;
-
-        if (m < BUFF_SIZE) {
-            if (ferror(fp))
-                return 1;
-            break;
-        }
     }
 
     fprintf(stderr, "[I::%s] %ld read pairs processed\n", __func__, pair_c);
-    fclose(fp);
+    bin_reader_close(fp);
+    free(sid);
+    free(spos);
     asm_destroy(dict);
     sd_destroy(sdict);
 
     return 0;
 }
 
-static int make_juicer_pre_file_from_bed(char *f, char *agp, char *fai, uint8_t mq, int scale, int count_gap, FILE *fo)
+static int make_juicer_pre_file_from_txt(char *f, char *agp, char *fai, uint8_t mq, int scale, int count_gap, FILE *fo, int fmt, int n_threads)
 {
-    FILE *fp;
-    char *line = NULL;
-    size_t ln = 0;
-    ssize_t read;
-    char cname0[4096], cname1[4096], rname0[4096], rname1[4096];
-    uint32_t s0, s1, e0, e1, i0, i1;
+    txt_pair_reader_t *r;
+    hic_pair_t pair;
+    uint32_t i0, i1;
     uint64_t p0, p1;
-    int8_t buff;
-    long rec_c, pair_c;
-    
-    khash_t(str) *hmseq; // for absent sequences
-    khint_t k;
-    int absent;
-    hmseq = kh_init(str);
 
     sdict_t *sdict = make_sdict_from_index(fai, 0);
     asm_dict_t *dict = agp? make_asm_dict_from_agp(sdict, agp) : make_asm_dict_from_sdict(sdict);
 
-    fp = fopen(f, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
-        exit(EXIT_FAILURE);
-    }
+    r = txt_pair_reader_open(f, sdict, fmt, n_threads);
 
-    s0 = s1 = e0 = e1 = 0;
     i0 = i1 = 0;
     p0 = p1 = 0;
-    rec_c = pair_c = 0;
-    buff = 0;
-    while ((read = getline(&line, &ln, fp)) != -1) {
-        if (buff == 0) {
-            sscanf(line, "%s %u %u %s", cname0, &s0, &e0, rname0);
-            ++buff;
-        } else if (buff == 1) {
-            sscanf(line, "%s %u %u %s", cname1, &s1, &e1, rname1);
-            if (is_read_pair(rname0, rname1)) {
-                ++pair_c;
-                
-                sd_coordinate_conversion(dict, sd_get(sdict, cname0), s0 / 2 + e0 / 2 + (s0 & 1 && e0 & 1), &i0, &p0, count_gap);
-                sd_coordinate_conversion(dict, sd_get(sdict, cname1), s1 / 2 + e1 / 2 + (s1 & 1 && e1 & 1), &i1, &p1, count_gap);
-                if (i0 == UINT32_MAX) {
-                    k = kh_put(str, hmseq, cname0, &absent);
-                    if (absent) {
-                        kh_key(hmseq, k) = strdup(cname0);
-                        fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname0);
-                    }
-                } else if(i1 == UINT32_MAX) {
-                    k = kh_put(str, hmseq, cname1, &absent);
-                    if (absent) {
-                        kh_key(hmseq, k) = strdup(cname1);
-                        fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname0);
-                    }
-                } else {
-                    if (strcmp(dict->s[i0].name, dict->s[i1].name) <= 0)
-                        fprintf(fo, "0\t%s\t%lu\t0\t1\t%s\t%lu\t1\n", dict->s[i0].name, p0 >> scale, dict->s[i1].name, p1 >> scale);
-                    else
-                        fprintf(fo, "0\t%s\t%lu\t1\t1\t%s\t%lu\t0\n", dict->s[i1].name, p1 >> scale, dict->s[i0].name, p0 >> scale);
-                }
-                buff = 0;
-            } else {
-                strcpy(cname0, cname1);
-                s0 = s1;
-                e0 = e1;
-                strcpy(rname0, rname1);
-                buff = 1;
-            }
-        }
-
-        if (++rec_c % 1000000 == 0)
-            fprintf(stderr, "[I::%s] %ld million records processed, %ld read pairs \n", __func__, rec_c / 1000000, pair_c);
+    while (txt_pair_read(r, &pair)) {
+        if (pair.q0 < mq || pair.q1 < mq || pair.dup)
+            continue;
+        sd_coordinate_conversion(dict, pair.c0, pair.p0, &i0, &p0, count_gap);
+        sd_coordinate_conversion(dict, pair.c1, pair.p1, &i1, &p1, count_gap);
+        if (i0 == UINT32_MAX || i1 == UINT32_MAX)
+            continue;
+        if (strcmp(dict->s[i0].name, dict->s[i1].name) <= 0)
+            fprintf(fo, "0\t%s\t%lu\t0\t1\t%s\t%lu\t1\n", dict->s[i0].name, p0 >> scale, dict->s[i1].name, p1 >> scale);
+        else
+            fprintf(fo, "0\t%s\t%lu\t1\t1\t%s\t%lu\t0\n", dict->s[i1].name, p1 >> scale, dict->s[i0].name, p0 >> scale);
     }
 
-    fprintf(stderr, "[I::%s] %ld read pairs processed\n", __func__, pair_c);
-    
-    for (k = 0; k < kh_end(hmseq); ++k)
-        if (kh_exist(hmseq, k))
-            free((char *) kh_key(hmseq, k));
-    kh_destroy(str, hmseq);
+    fprintf(stderr, "[I::%s] %ld read pairs processed\n", __func__, r->pair_c);
 
-    if (line)
-        free(line);
-    fclose(fp);
+    txt_pair_reader_close(r);
     asm_destroy(dict);
     sd_destroy(sdict);
 
     return 0;
 }
 
-static int32_t get_target_end(uint32_t *cigar, int n_cigar, int32_t s)
-{
-    int i;
-    uint8_t c;
-    for (i = 0; i < n_cigar; ++i) {
-        c = cigar[i] & BAM_CIGAR_MASK;
-        if (c == BAM_CMATCH || c == BAM_CDEL)
-            s += cigar[i] >> BAM_CIGAR_SHIFT;
-    }
-    return s;
-}
-
-static char *parse_bam_rec(bam1_t *b, bam_header_t *h, uint8_t q, int32_t *s, int32_t *e, char **cname)
+static int make_juicer_pre_file_from_bam(char *f, char *agp, char *fai, uint8_t mq, int scale, int count_gap, FILE *fo, int n_threads, long max_mem, char *tmp)
 {
-    // 0x4 0x100 0x400 0x800
-    if (b->core.flag & 0xD04)
-        return 0;
-    *cname = h->target_name[b->core.tid];
-    if (b->core.qual < q) {
-        *s = -1;
-        *e = -1;
-    } else {
-        *s = b->core.pos + 1;
-        *e = get_target_end(bam1_cigar(b), b->core.n_cigar, b->core.pos) + 1;
-    }
-
-    return strdup(bam1_qname(b));
-}
-
-static int make_juicer_pre_file_from_bam(char *f, char *agp, char *fai, uint8_t mq, int scale, int count_gap, FILE *fo)
-{
-    bamFile fp;
-    bam_header_t *h;
-    bam1_t *b;
-    char *cname0, *cname1, *rname0, *rname1;
-    int32_t s0, s1, e0, e1;
+    bam_pair_reader_t *r;
+    hic_pair_t pair;
     uint32_t i0, i1;
     uint64_t p0, p1;
-    int8_t buff;
-    long rec_c, pair_c;
-
-    khash_t(str) *hmseq; // for absent sequences
-    khint_t k;
-    int absent;
-    hmseq = kh_init(str);
 
     sdict_t *sdict = make_sdict_from_index(fai, 0);
     asm_dict_t *dict = agp? make_asm_dict_from_agp(sdict, agp) : make_asm_dict_from_sdict(sdict);
 
-    fp = bam_open(f, "r"); // sorted by read name
-    if (fp == NULL) {
-        fprintf(stderr, "[E::%s] cannot open fail %s for reading\n", __func__, f);
-        exit(EXIT_FAILURE);
-    }
+    r = bam_pair_reader_open(f, sdict, mq, n_threads, max_mem, tmp);
 
-    h = bam_header_read(fp);
-    b = bam_init1();
-    cname0 = cname1 = rname0 = rname1 = 0;
-    s0 = s1 = e0 = e1 = 0;
     i0 = i1 = 0;
     p0 = p1 = 0;
-    rec_c = pair_c = 0;
-    buff = 0;
-    while (bam_read1(fp, b) >= 0 ) {
-        if (buff == 0) {
-            rname0 = parse_bam_rec(b, h, mq, &s0, &e0, &cname0);
-            if (!rname0)
-                continue;
-            ++buff;
-        } else if (buff == 1) {
-            rname1 = parse_bam_rec(b, h, mq, &s1, &e1, &cname1);
-            if (!rname1)
-                continue;
-            if (strcmp(rname0, rname1) == 0) {
-                ++pair_c;
-
-                if (s0 > 0 && s1 >0) {
-                    sd_coordinate_conversion(dict, sd_get(sdict, cname0), s0 / 2 + e0 / 2 + (s0 & 1 && e0 & 1), &i0, &p0, count_gap);
-                    sd_coordinate_conversion(dict, sd_get(sdict, cname1), s1 / 2 + e1 / 2 + (s1 & 1 && e1 & 1), &i1, &p1, count_gap);
-
-                    if (i0 == UINT32_MAX) {
-                        k = kh_put(str, hmseq, cname0, &absent);
-                        if (absent) {
-	                        kh_key(hmseq, k) = strdup(cname0);
-	                        fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname0);
-                        }
-                    } else if (i1 == UINT32_MAX) {
-                        k = kh_put(str, hmseq, cname1, &absent);
-                        if (absent) {
-	                        kh_key(hmseq, k) = strdup(cname1);
-	                        fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname1);
-                        }
-                    } else {
-                        if (strcmp(dict->s[i0].name, dict->s[i1].name) <= 0)
-                            fprintf(fo, "0\t%s\t%lu\t0\t1\t%s\t%lu\t1\n", dict->s[i0].name, p0 >> scale, dict->s[i1].name, p1 >> scale);
-                        else
-                            fprintf(fo, "0\t%s\t%lu\t1\t1\t%s\t%lu\t0\n", dict->s[i1].name, p1 >> scale, dict->s[i0].name, p0 >> scale);
-                    }
-                }
-                free(rname0);
-                free(rname1);
-                rname0 = 0;
-                rname1 = 0;
-                buff = 0;
-            } else {
-                cname0 = cname1;
-                s0 = s1;
-                e0 = e1;
-                free(rname0);
-                rname0 = rname1;
-                rname1 = 0;
-                buff = 1;
-            }
-        }
-
-        if (++rec_c % 1000000 == 0)
-            fprintf(stderr, "[I::%s] %ld million records processed, %ld read pairs \n", __func__, rec_c / 1000000, pair_c);
+    while (bam_pair_read(r, &pair)) {
+        if (pair.q0 < mq || pair.q1 < mq || pair.dup)
+            continue;
+        sd_coordinate_conversion(dict, pair.c0, pair.p0, &i0, &p0, count_gap);
+        sd_coordinate_conversion(dict, pair.c1, pair.p1, &i1, &p1, count_gap);
+        if (i0 == UINT32_MAX || i1 == UINT32_MAX)
+            continue;
+        if (strcmp(dict->s[i0].name, dict->s[i1].name) <= 0)
+            fprintf(fo, "0\t%s\t%lu\t0\t1\t%s\t%lu\t1\n", dict->s[i0].name, p0 >> scale, dict->s[i1].name, p1 >> scale);
+        else
+            fprintf(fo, "0\t%s\t%lu\t1\t1\t%s\t%lu\t0\n", dict->s[i1].name, p1 >> scale, dict->s[i0].name, p0 >> scale);
     }
 
-    fprintf(stderr, "[I::%s] %ld read pairs processed\n", __func__, pair_c);
+    fprintf(stderr, "[I::%s] %ld read pairs processed\n", __func__, r->pair_c);
 
-    for (k = 0; k < kh_end(hmseq); ++k)
-	if (kh_exist(hmseq, k))
-		free((char *) kh_key(hmseq, k));
-    kh_destroy(str, hmseq);
-
-    if (rname0)
-        free(rname0);
-    if (rname1)
-        free(rname1);
-    bam_destroy1(b);
-    bam_header_destroy(h);
-    bam_close(fp);
+    bam_pair_reader_close(r);
     asm_destroy(dict);
     sd_destroy(sdict);
 
@@ -428,14 +270,17 @@ uint64_t assembly_scale_max_seq(asm_dict_t *dict, int *scale, uint64_t max_s, ui
 
 static void print_help(FILE *fp_help)
 {
-    fprintf(fp_help, "Usage: juicer_pre [options] <hic.bed>|<hic.bam>|<hic.bin> <scaffolds.agp> <contigs.fa.fai>\n");
+    fprintf(fp_help, "Usage: juicer_pre [options] <hic.bed>|<hic.bedpe>|<hic.pairs>|<hic.bam>|<hic.bin> <scaffolds.agp> <contigs.fa.fai>\n");
     fprintf(fp_help, "Options:\n");
     fprintf(fp_help, "    -a                preprocess for assembly mode\n");
     fprintf(fp_help, "    -q INT            minimum mapping quality [10]\n");
+    fprintf(fp_help, "    -t INT            number of threads for reading BAM/BED/PAIRS [1]\n");
     fprintf(fp_help, "    -o STR            output file prefix (required for '-a' mode) [stdout]\n");
+    fprintf(fp_help, "    --bam-mem STR     memory for joining mates in coordinate-sorted BAM [1G]\n");
 }
 
 static ko_longopt_t long_options[] = {
+    { "bam-mem",        ko_required_argument, 301 },
     { "help",           ko_no_argument, 'h' },
     { 0, 0, 0 }
 };
@@ -449,15 +294,18 @@ int main(int argc, char *argv[])
 
     FILE *fo;
     char *fai, *agp, *agp1, *link_file, *out, *out1, *annot, *lift, *ext;
-    int mq, asm_mode;;
+    int mq, asm_mode, n_threads;
+    long max_mem;
 
-    const char *opt_str = "q:ao:h";
+    const char *opt_str = "q:ao:t:h";
     ketopt_t opt = KETOPT_INIT;
     int c, ret;
     FILE *fp_help = stderr;
     fai = agp = agp1 = link_file = out = out1 = annot = lift = 0;
     mq = 10;
     asm_mode = 0;
+    n_threads = 1;
+    max_mem = 1000000000L;
 
     while ((c = ketopt(&opt, argc, argv, 1, opt_str, long_options)) >= 0) {
         if (c == 'o') {
@@ -466,6 +314,10 @@ int main(int argc, char *argv[])
             mq = atoi(opt.arg);
         } else if (c == 'a') {
             asm_mode = 1;
+        } else if (c == 't') {
+            n_threads = atoi(opt.arg);
+        } else if (c == 301) {
+            max_mem = (long) parse_num(opt.arg);
         } else if (c == 'h') {
             fp_help = stdout;
         } else if (c == '?') {
@@ -498,6 +350,16 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (n_threads < 1) {
+        fprintf(stderr, "[E::%s] invalid number of threads: %d\n", __func__, n_threads);
+        return 1;
+    }
+
+    if (max_mem < 1000000L) {
+        fprintf(stderr, "[E::%s] memory for joining BAM mates should be at least 1M: %ld\n", __func__, max_mem);
+        return 1;
+    }
+
     uint8_t mq8;
     mq8 = (uint8_t) mq;
 
@@ -543,15 +405,18 @@ int main(int argc, char *argv[])
     ext = link_file + strlen(link_file) - 4;
     if (strcmp(ext, ".bam") == 0) {
         fprintf(stderr, "[I::%s] make juicer pre input from BAM file %s\n", __func__, link_file);
-        ret = make_juicer_pre_file_from_bam(link_file, agp1, fai, mq8, scale, !asm_mode, fo);
-    } else if (strcmp(ext, ".bed") == 0) {
+        ret = make_juicer_pre_file_from_bam(link_file, agp1, fai, mq8, scale, !asm_mode, fo, n_threads, max_mem, out);
+    } else if (strcmp(ext, ".bed") == 0 || has_file_ext(link_file, ".bedpe") || has_file_ext(link_file, ".bed.gz") || has_file_ext(link_file, ".bedpe.gz")) {
         fprintf(stderr, "[I::%s] make juicer pre input from BED file %s\n", __func__, link_file);
-        ret = make_juicer_pre_file_from_bed(link_file, agp1, fai, mq8, scale, !asm_mode, fo);
+        ret = make_juicer_pre_file_from_txt(link_file, agp1, fai, mq8, scale, !asm_mode, fo, PAIR_FMT_BED, n_threads);
+    } else if (has_file_ext(link_file, ".pairs") || has_file_ext(link_file, ".pairs.gz")) {
+        fprintf(stderr, "[I::%s] make juicer pre input from PAIRS file %s\n", __func__, link_file);
+        ret = make_juicer_pre_file_from_txt(link_file, agp1, fai, mq8, scale, !asm_mode, fo, PAIR_FMT_PAIRS, n_threads);
     } else if (strcmp(ext, ".bin") == 0) {
         fprintf(stderr, "[I::%s] make juicer pre input from BIN file %s\n", __func__, link_file);
-        ret = make_juicer_pre_file_from_bin(link_file, agp1, fai, scale, !asm_mode, fo);
+        ret = make_juicer_pre_file_from_bin(link_file, agp1, fai, mq8, scale, !asm_mode, fo);
     } else {
-        fprintf(stderr, "[E::%s] unknown link file format. File extension .bam, .bed or .bin is expected\n", __func__);
+        fprintf(stderr, "[E::%s] unknown link file format. File extension .bam, .bed(.gz), .bedpe(.gz), .pairs(.gz) or .bin is expected\n", __func__);
         exit(EXIT_FAILURE);
     }
 
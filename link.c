@@ -39,7 +39,15 @@
 #include "sdict.h"
 #include "enzyme.h"
 #include "link.h"
+#include "pairs.h"
+#include "binio.h"
 #include "asset.h"
+#include "kthread.h"
+
+#if !defined(NO_SIMD) && defined(__GNUC__) && defined(__x86_64__)
+#define INTER_LINK_AVX2
+#include <immintrin.h>
+#endif
 
 #undef DEBUG
 #undef DEBUG_NOISE
@@ -48,93 +56,80 @@
 #define USE_MEDIAN_NORM
 #define MIN_RE_DENS .1
 static uint32_t MAX_RADIUS = 100;
+// intra bands kept cell by cell, the norms of 10 bands beyond the radius are checked for zeros
+static uint32_t MAX_BAND = 110;
+
+typedef struct {
+    uint64_t key; // c0 << 32 | c1
+    uint32_t *cell; // cells of the pair, link[0...3] in one block
+} pair_cell_t;
+
+// sequence pair keys (c0 << 32 | c1) collide under kh_int64_hash_func, mix all bits first
+static inline khint32_t kh_pair_hash_func(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (khint32_t) key;
+}
 
-KHASH_SET_INIT_STR(str)
+#define pair_cell_hash(a) kh_pair_hash_func((a).key)
+#define pair_cell_eq(a, b) ((a).key == (b).key)
+KHASH_INIT(pair, pair_cell_t, char, 0, pair_cell_hash, pair_cell_eq)
 
 void intra_link_mat_destroy(intra_link_mat_t *link_mat)
 {
     uint32_t i;
-    for (i = 0; i < link_mat->n; ++i)
-        if (link_mat->links[i].n)
+    for (i = 0; i < link_mat->n; ++i) {
+        if (link_mat->links[i].n) {
             free(link_mat->links[i].link);
+            free(link_mat->links[i].d);
+        }
+    }
     if (link_mat->links)
         free(link_mat->links);
+    if (link_mat->re_dens) {
+        for (i = 0; i < link_mat->n; ++i)
+            free(link_mat->re_dens[i]);
+        free(link_mat->re_dens);
+    }
     free(link_mat);
 }
 
-void inter_link_mat_destroy(inter_link_mat_t *link_mat)
+static void inter_link_mat_free_pairs(inter_link_mat_t *link_mat)
 {
     uint32_t i, j;
     for (i = 0; i < link_mat->n; ++i) {
-        if (link_mat->links[i].n) {
-            for (j = 0; j < 4; ++j) {
-                free(link_mat->links[i].link[j]);
-                free(link_mat->links[i].linkb[j]);
-            }
-        }
+        // link[0...3] are allocated in one block
+        free(link_mat->links[i].link[0]);
+        for (j = 0; j < 4; ++j)
+            free(link_mat->links[i].linkb[j]);
     }
     if (link_mat->links)
         free(link_mat->links);
+    if (link_mat->h)
+        kh_destroy(pair, (khash_t(pair) *) link_mat->h);
+}
+
+void inter_link_mat_destroy(inter_link_mat_t *link_mat)
+{
+    uint32_t i;
+    inter_link_mat_free_pairs(link_mat);
+    if (link_mat->re_dens) {
+        for (i = 0; i < link_mat->n_seq; ++i)
+            free(link_mat->re_dens[i]);
+        free(link_mat->re_dens);
+    }
+    free(link_mat->bn);
+    free(link_mat->ba);
     free(link_mat);
 }
 
-// index mapping (c0, c1) -> (i, j) -> (n * 2 - i - 3) * i / 2 + j - 1 
-// 0  (0, 1)
-// 1  (0, 2) 5  (1, 2)
-// 2  (0, 3) 6  (1, 3) 9  (2, 3)
-// 3  (0, 4) 7  (1, 4) 10 (2, 4) 12 (3, 4)
-// 4  (0, 5) 8  (1, 5) 11 (2, 5) 13 (3, 5) 14 (4, 5)
-// number of cells
-// (b0, b1, r) -> n -> MIN(b0, r) * MIN(b1, r)
-// index mapping for cells
-// (i, j, r) -> p -> MAX(0, i - 1) * b1 + j
-// reverse index mapping for cells
-// (p, r) -> (i, j) -> (p / b1, p % b1)
-//     # # # # # #
-//     o x x x x x
-//     o o x x x x
-// b0  o o o x x x
-//     o o o o x x
-//     o o o o o x
-//     o o o o o o
-//     O o o o o o
-//          b1
-// TODO improve memory efficiency
-// number of cells
-// (b0, b1, r) -> n
-// for (k = 0; k < MIN(b0, r); ++k) p += MIN(b1, r - k)
-// index mapping for cells
-// (i, j, r) -> p
-// for (k = 0; k < i; ++k) p += MIN(b1, r - k)
-// p += j
-// reverse index mapping for cells
-// (p, r) -> (i, j)
-// ???
-// (1) radius [15] >= b0 + b1 [14] >= b0 [8] >= b1 [6]
-//     b0 * b1
-//     o o o o o o
-//     o o o o o o
-//     o o o o o o
-// b0  o o o o o o
-//     o o o o o o
-//     o o o o o o
-//     o o o o o o
-//     O o o o o o
-//          b1
-// (2) b0 + b1 [14] >= radius [10] >= b0 [8] >= b1 [6]
-//     k = (b0 + b1 - radius)
-//     b0 * b1 - k * (k - 1) / 2
-//     o o o # # #
-//     o o o o # #
-//     o o o o o #
-// b0  o o o o o o
-//     o o o o o o
-//     o o o o o o
-//     o o o o o o
-//     O o o o o o
-//          b1
-// (3) b0 [8] >= radius [7] >= b1 [6]
-//     (r - b1) * 
+// sequence pairs (c0, c1), c0 < c1, are only allocated once they get a link within the radius
+// only cells (i, j) with i + j < r, r = MIN(R, b0 + b1 - 1), are stored, row by row
+// the first f = MAX(0, r - b1 + 1) rows are full, row i >= f holds r - i cells
 //     # # # # # #
 //     o # # # # #
 //     o o # # # #
@@ -144,135 +139,119 @@ void inter_link_mat_destroy(inter_link_mat_t *link_mat)
 //     o o o o o o
 //     O o o o o o
 //          b1
-// (4) b0 [8] >= b1 [6] >= radius [4]
-//     # # # # # #
-//     # # # # # #
-//     # # # # # #
-// b0  # # # # # #
-//     o # # # # #
-//     o o # # # #
-//     o o o # # #
-//     O o o o # #
-//          b1
-// 
+// number of cells
+// (b0, b1, r) -> n -> p(b0, 0)
+// index mapping for cells
+// (i, j, r) -> p -> i <= f? i * b1 + j : f * b1 + (i - f) * (r * 2 - f - i + 1) / 2 + j
+// reverse index mapping for cells
+// (p, r) -> (i, j) -> p < f * b1? (p / b1, p % b1) : the largest i with p(i, 0) <= p, j = p - p(i, 0)
+// cells are visited row by row in all loops, so the reverse mapping is never evaluated
+static inline uint64_t inter_link_cell_index(uint32_t b1, uint32_t r, uint32_t i, uint32_t j)
+{
+    uint64_t f;
+    f = r + 1 > b1? r + 1 - b1 : 0;
+    if (i <= f)
+        return (uint64_t) i * b1 + j;
+    return f * b1 + (i - f) * (r * 2 - f - i + 1) / 2 + j;
+}
+
+// number of cells of a sequence pair with b0 and b1 bands within radius r
+static inline uint64_t inter_link_pair_cells(uint32_t b0, uint32_t b1, uint32_t r)
+{
+    return inter_link_cell_index(b1, MIN(r, b0 + b1 - 1), b0, 0);
+}
+
+// number of cells of all sequence pairs, nb[b]: number of sequences with b bands, b <= r
+static uint64_t inter_link_all_pair_cells(const uint64_t *nb, uint32_t r)
+{
+    uint32_t x, y;
+    uint64_t c;
+
+    c = 0;
+    for (x = 1; x <= r; ++x) {
+        if (nb[x] == 0)
+            continue;
+        c += nb[x] * (nb[x] - 1) / 2 * inter_link_pair_cells(x, x, r);
+        for (y = x + 1; y <= r; ++y)
+            if (nb[y])
+                c += nb[x] * nb[y] * inter_link_pair_cells(x, y, r);
+    }
+    return c;
+}
+
 inter_link_mat_t *inter_link_mat_init(asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius)
 {
     inter_link_mat_t *link_mat;
-    inter_link_t *link;
-    uint32_t i, j, k, l, b0, b1, n, m, p, r2;
-    double a0, a1, a;
-    double **re_dens, re;
+    uint32_t i, n, b, r2;
 
     n = dict->n;
-    m = (long) n * (n - 1) / 2;
     r2 = resolution * 2;
-    link_mat = (inter_link_mat_t *) malloc(sizeof(inter_link_mat_t));
-    link_mat->n = m;
+    link_mat = (inter_link_mat_t *) calloc(1, sizeof(inter_link_mat_t));
     link_mat->r = radius;
-    link_mat->links = (inter_link_t *) malloc(m * sizeof(inter_link_t));
-    
-    re_dens = calc_re_cuts_density2(re_cuts, resolution, dict);
-    
+    link_mat->h = kh_init(pair);
+    link_mat->n_seq = n;
+    link_mat->s0 = 0;
+    link_mat->s1 = n;
+    link_mat->bn = (uint32_t *) calloc(n, sizeof(uint32_t));
+    link_mat->ba = (double *) calloc(n, sizeof(double));
     for (i = 0; i < n; ++i) {
-        if (dict->s[i].len < r2) {
-            for (j = i + 1; j < n; ++j)
-                link_mat->links[(long) (n * 2 - i - 3) * i / 2 + j - 1].n = 0;
+        if (dict->s[i].len < r2)
             continue;
-        }
-        
-        b0 = MIN(radius, div_ceil(dict->s[i].len, r2));
+        b = MIN(radius, div_ceil(dict->s[i].len, r2));
+        link_mat->bn[i] = b;
         // relative size of the last cell
-        a0 = MIN(1., (dict->s[i].len / 2. - (double) (b0 - 1) * resolution) / resolution);
-        for (j = i + 1; j < n; ++j) {
-            link = &link_mat->links[(long) (n * 2 - i - 3) * i / 2 + j - 1];
-            if (dict->s[j].len < r2) {
-                link->n = 0;
-                continue;
-            }
-            
-            b1 = MIN(radius, div_ceil(dict->s[j].len, r2));
-            // relative size of the last cell
-            a1 = MIN(1., (dict->s[j].len / 2. - (double) (b1 - 1) * resolution) / resolution);
-            p = b0 * b1; 
-            link->c0 = i;
-            link->c1 = j;
-            link->b0 = b0;
-            link->b1 = b1;
-            link->r = MIN(radius, (uint32_t) (b0 + b1 - 1));
-            link->n = p;
-            link->n0 = 0;
-            link->linkt = 0;
-            assert(p == (long) b0 * b1);
-            for (k = 0; k < 4; ++k) {
-                link->link[k] = (double *) calloc(p, sizeof(double));
-                link->linkb[k] = (double *) calloc(link->r, sizeof(double));
-            }
-
-            // calculate relative areas for each cell 
-            for (l = 0; l < p; ++l) {
-                a = 1.;
-                if (l / b1 == b0 - 1)
-                    a *= a0;
-                if (l % b1 == b1 - 1)
-                    a *= a1;
-                if (a < .5)
-                    a = .0;
-                re = re_dens? re_dens[i][l / b1] * re_dens[j][l % b1] : 1.;
-                a *= re < MIN_RE_DENS? .0 : re;
-                if (a < FLT_EPSILON)
-                    a = FLT_EPSILON;
-                else if (a > 1.)
-                    a = -1. / a;
-                for (k = 0; k < 4; ++k)
-                    link->link[k][l] = a;
-            }
-            memset(link->norms, 0, sizeof(link->norms));
-        }
-    }
-
-    if (re_dens) {
-        for (i = 0; i < n; ++i)
-            free(re_dens[i]);
-        free(re_dens);
+        link_mat->ba[i] = MIN(1., (dict->s[i].len / 2. - (double) (b - 1) * resolution) / resolution);
     }
+    link_mat->re_dens = calc_re_cuts_density2(re_cuts, resolution, dict);
 
     return link_mat;
 }
 
-long estimate_inter_link_mat_init_rss(asm_dict_t *dict, uint32_t resolution, uint32_t radius)
+// bytes of a sequence pair with b0 and b1 bands within radius r once it has a link
+// the pair array grows by doubling and the hash table is kept at most 3/4 full
+static inline long inter_link_pair_bytes(uint32_t b0, uint32_t b1, uint32_t r)
 {
-    long bytes, p, m;
-    uint32_t i, j, b0, b1, n, r, r2;
+    return 2 * sizeof(inter_link_t) + 2 * (sizeof(uint64_t) + sizeof(uint32_t)) + MIN(r, b0 + b1 - 1) * 4 * sizeof(double) + inter_link_pair_cells(b0, b1, r) * 4 * sizeof(uint32_t);
+}
 
-    n = dict->n;
-    m = (long) n * (n - 1) / 2;
-    if (m > UINT32_MAX)
-        return -1;
+// n_pair: maximum number of sequence pairs with links
+long estimate_inter_link_mat_init_rss(asm_dict_t *dict, uint32_t resolution, uint32_t radius, uint64_t n_pair)
+{
+    long bytes, bytes_pair, bytes_all;
+    uint64_t b, m, b0, b1, *nb;
+    uint32_t i, n, r2;
 
+    n = dict->n;
     r2 = resolution * 2;
-
-    bytes = 0;
-    bytes += sizeof(inter_link_mat_t);
-    bytes += m * sizeof(inter_link_t);
-
+    m = b0 = b1 = 0;
+    nb = (uint64_t *) calloc(radius + 1, sizeof(uint64_t));
     for (i = 0; i < n; ++i) {
         if (dict->s[i].len < r2)
             continue;
-
-        b0 = MIN(radius, div_ceil(dict->s[i].len, r2));
-        for (j = i + 1; j < n; ++j) {
-            if (dict->s[j].len < r2)
-                continue;
-
-            b1 = MIN(radius, div_ceil(dict->s[j].len, r2));
-            p = b0 * b1;
-            if (p > UINT32_MAX)
-                return -1;
-            r = MIN(radius, (uint32_t) (b0 + b1 - 1));
-
-            bytes += (p + r) * 4 * sizeof(double);
+        b = MIN(radius, div_ceil(dict->s[i].len, r2));
+        ++m;
+        ++nb[b];
+        if (b > b0) {
+            b1 = b0;
+            b0 = b;
+        } else if (b > b1) {
+            b1 = b;
         }
     }
+    m = m > 1? m * (m - 1) / 2 : 0;
+
+    bytes = 0;
+    bytes += sizeof(inter_link_mat_t);
+    bytes += n * (sizeof(uint32_t) + sizeof(double));
+
+    bytes_pair = 2 * sizeof(inter_link_t) + 2 * (sizeof(uint64_t) + sizeof(uint32_t));
+    // all pairs linked
+    bytes_all = m * (bytes_pair + radius * 4 * sizeof(double)) + inter_link_all_pair_cells(nb, radius) * 4 * sizeof(uint32_t);
+    // n_pair pairs linked, each no larger than the largest one
+    if (n_pair < m)
+        bytes_all = MIN(bytes_all, (long) n_pair * inter_link_pair_bytes(b0, b1, radius));
+    bytes += bytes_all;
+    free(nb);
 
     return bytes;
 }
@@ -286,21 +265,43 @@ long estimate_inter_link_mat_init_rss(asm_dict_t *dict, uint32_t resolution, uin
 // 22 (0,4) 19 (1,4) 15 (2,4) 10 (3,4) 4  (4,4)
 // 25 (0,5) 23 (1,5) 20 (2,5) 16 (3,5) 11 (4,5) 5  (5,5)
 // 27 (0,6) 26 (1,6) 24 (2,6) 21 (3,6) 17 (4,6) 12 (5,6) 6  (6,6)
+// only the first MAX_BAND distances are kept, cells beyond are summed into a total per band
+static inline long intra_link_band_start(uint32_t n, uint32_t k)
+{
+    return (long) (n * 2 - k + 1) * k / 2;
+}
+
+static inline long intra_link_cells(uint32_t n)
+{
+    return intra_link_band_start(n, MIN(n, MAX_BAND));
+}
+
+// reverse of intra_link_band_start, the band holding index p
+static inline uint32_t intra_link_band(uint32_t n, long p)
+{
+    uint32_t k;
+    double b;
+    b = n * 2. + 1;
+    k = (uint32_t) ((b - sqrt(b * b - 8. * p)) / 2);
+    while (k > 0 && intra_link_band_start(n, k) > p)
+        --k;
+    while (k < n - 1 && intra_link_band_start(n, k + 1) <= p)
+        ++k;
+    return k;
+}
+
 intra_link_mat_t *intra_link_mat_init(asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution)
 {
     intra_link_mat_t *link_mat;
     intra_link_t *link;
-    uint32_t i, j, k, n, b, p;
-    double a;
-    double **re_dens, *dens, re;
+    uint32_t i, n, b, p;
 
     n = dict->n;
     link_mat = (intra_link_mat_t *) malloc(sizeof(intra_link_mat_t));
     link_mat->n = n;
     link_mat->links = (intra_link_t *) calloc(n, sizeof(intra_link_t));
+    link_mat->re_dens = calc_re_cuts_density1(re_cuts, resolution, dict);
 
-    re_dens = calc_re_cuts_density1(re_cuts, resolution, dict);
-    
     for (i = 0; i < n; ++i) {
         link = &link_mat->links[i];
         link->c = i;
@@ -311,46 +312,15 @@ intra_link_mat_t *intra_link_mat_init(asm_dict_t *dict, re_cuts_t *re_cuts, uint
         b = div_ceil(dict->s[i].len, resolution);
         link->n = b;
         // relative size of the last cell
-        a = ((double) dict->s[i].len - (double) (b - 1) * resolution) / resolution;
-        p = (long) b * (b + 1) / 2;
-        link->link = (double *) calloc(p, sizeof(double));
-        if (re_dens) {
-            dens = re_dens[i];
-            for (j = 0; j < b; ++j) {
-                for (k = j; k < b; ++k) {
-                    re = dens[j] * dens[k];
-                    link->link[(long) (b * 2 - k + j - 1) * (k - j) / 2 + k] = re < MIN_RE_DENS? .0 : re;
-                }
-            }
-        } else {
-            for (j = 0; j < p; ++j)
-                link->link[j] = 1.;
-        }
-        // calculate relative area for each cell
-        for (j = 0; j < b; ++j)
-            link->link[(long) (b + j) * (b - j - 1) / 2 + b - 1] *= (a < .5? .0 : a);
-        // the last cell in the diagonal
-        link->link[b - 1] *= (a < SQRT2_2? .0 : a);
-        for (j = 0; j < p; ++j) {
-            if (link->link[j] < FLT_EPSILON)
-                link->link[j] = FLT_EPSILON;
-            else if (link->link[j] > 1.)
-                link->link[j] = -1. / link->link[j];
-        }
-        // need a least half size to count
-        //for (j = 0; j < p; ++j)
-        //    if (link->link[j] < .5)
-        //        link->link[j] = -FLT_MAX;
+        link->a = ((double) dict->s[i].len - (double) (b - 1) * resolution) / resolution;
+        p = intra_link_cells(b);
+        link->link = (uint32_t *) calloc(p, sizeof(uint32_t));
+        link->d = b > MAX_BAND + 1? (double *) calloc(b - 1 - MAX_BAND, sizeof(double)) : 0;
 #ifdef DEBUG
         printf("[I::%s] %s bins: %d\n", __func__, dict->s[i].name, link->n);
 #endif
     }
 
-    if (re_dens) {
-        for (i = 0; i < n; ++i)
-            free(re_dens[i]);
-        free(re_dens);
-    }
     return link_mat;
 }
 
@@ -369,11 +339,13 @@ long estimate_intra_link_mat_init_rss(asm_dict_t *dict, uint32_t resolution)
         if (dict->s[i].len < resolution)
             continue;
         b = div_ceil(dict->s[i].len, resolution);
-        p = (long) b * (b + 1) / 2;
+        p = intra_link_cells(b);
         if (p > UINT32_MAX)
             return -1;
 
-        bytes += p * sizeof(double);
+        bytes += p * sizeof(uint32_t);
+        if (b > MAX_BAND + 1)
+            bytes += (b - 1 - MAX_BAND) * sizeof(double);
     }
     return bytes;
 }
@@ -382,16 +354,13 @@ intra_link_mat_t *intra_link_mat_init_sdict(sdict_t *dict, re_cuts_t *re_cuts, u
 {
     intra_link_mat_t *link_mat;
     intra_link_t *link;
-    uint32_t i, j, k, n, b, p;
-    double a;
-    double **re_dens, *dens, re;
+    uint32_t i, n, b, p;
     
     n = dict->n;
     link_mat = (intra_link_mat_t *) malloc(sizeof(intra_link_mat_t));
     link_mat->n = n;
     link_mat->links = (intra_link_t *) malloc(n * sizeof(intra_link_t));
-
-    re_dens = calc_re_cuts_density(re_cuts, resolution);
+    link_mat->re_dens = calc_re_cuts_density(re_cuts, resolution);
 
     for (i = 0; i < n; ++i) {
         link = &link_mat->links[i];
@@ -403,36 +372,10 @@ intra_link_mat_t *intra_link_mat_init_sdict(sdict_t *dict, re_cuts_t *re_cuts, u
         b = div_ceil(dict->s[i].len, resolution);
         link->n = b;
         // relative size of the last cell
-        a = ((double) dict->s[i].len - (double) (b - 1) * resolution) / resolution;
-        p = (long) b * (b + 1) / 2;
-        link->link = (double *) calloc(p, sizeof(double));
-        if (re_dens) {
-            dens = re_dens[i];
-            for (j = 0; j < b; ++j) {
-                for (k = j; k < b; ++k) {
-                    re = dens[j] * dens[k];
-                    link->link[(long) (b * 2 - k + j - 1) * (k - j) / 2 + k] = re < MIN_RE_DENS? .0 : re;
-                }
-            }
-        } else {
-            for (j = 0; j < p; ++j)
-                link->link[j] = 1.;
-        }
-        // calculate relative area for each cell
-        for (j = 0; j < b; ++j)
-            link->link[(long) (b + j) * (b - j - 1) / 2 + b - 1] *= (a < .5? .0 : a);
-        // the last cell in the diagonal
-        link->link[b - 1] *= (a < SQRT2_2? .0 : a);
-        for (j = 0; j < p; ++j) {
-            if (link->link[j] < FLT_EPSILON)
-                link->link[j] = FLT_EPSILON;
-            else if (link->link[j] > 1.)
-                link->link[j] = -1. / link->link[j];
-        }
-        // need a least half size to count
-        //for (j = 0; j < p; ++j)
-        //    if (link->link[j] < .5)
-        //        link->link[j] = -FLT_MAX;
+        link->a = ((double) dict->s[i].len - (double) (b - 1) * resolution) / resolution;
+        p = intra_link_cells(b);
+        link->link = (uint32_t *) calloc(p, sizeof(uint32_t));
+        link->d = b > MAX_BAND + 1? (double *) calloc(b - 1 - MAX_BAND, sizeof(double)) : 0;
 #ifdef DEBUG
         printf("[I::%s] %s bins: %d\n", __func__, dict->s[i].name, link->n);
 #endif
@@ -456,231 +399,1129 @@ long estimate_intra_link_mat_init_sdict_rss(sdict_t *dict, uint32_t resolution)
         if (dict->s[i].len < resolution)
             continue;
         b = div_ceil(dict->s[i].len, resolution);
-        p = (long) b * (b + 1) / 2;
+        p = intra_link_cells(b);
         if (p > UINT32_MAX)
             return -1;
 
-        bytes += p * sizeof(double);
+        bytes += p * sizeof(uint32_t);
+        if (b > MAX_BAND + 1)
+            bytes += (b - 1 - MAX_BAND) * sizeof(double);
     }
     return bytes;
 }
 
-static inline int signf(double l) {
-    return (l > 0) - (l < 0);
+// link count per unit area, no normalisation for small cells to avoid extreme cases
+static inline double normalise_by_size(uint32_t c, double a)
+{
+    return a > 0? c / a : -DBL_MAX;
 }
 
-static inline void normalise_by_size(double *l)
+// relative area of intra cell (j, k), j <= k, of sequence i scaled by the restriction site density, 0 if too small
+static inline double intra_link_cell_area(intra_link_mat_t *link_mat, uint32_t i, uint32_t j, uint32_t k)
 {
-    int s;
-    s = signf(*l);
-    *l *= s;
-    double f, i;
-    // f is the decimal part, i.e., area * re
-    // i is the integer part, i.e., links
-    f = modf(*l, &i);
-    if (f < FLT_EPSILON) {
-        f = 1.;
-        i -= 1.;
+    double a, re;
+    intra_link_t *link;
+
+    link = &link_mat->links[i];
+    a = 1.;
+    if (link_mat->re_dens) {
+        re = link_mat->re_dens[i][j] * link_mat->re_dens[i][k];
+        a = re < MIN_RE_DENS? .0 : re;
+    }
+    if (k == link->n - 1) {
+        a *= link->a < .5? .0 : link->a;
+        // the last cell in the diagonal
+        if (j == k)
+            a *= link->a < SQRT2_2? .0 : link->a;
     }
-    assert(i >= 0 && f > 0);
-    // no normalisation for small cells to avoid extreme cases
-    if (fabs(f - FLT_EPSILON) < DBL_EPSILON) {
-        *l = -DBL_MAX;
+    return a < FLT_EPSILON? .0 : a;
+}
+
+void inter_link_buf_destroy(inter_link_buf_t *buf)
+{
+    if (!buf)
         return;
+    free(buf->a);
+    free(buf);
+}
+
+inter_link_buf_t *inter_link_buf_init(long max_mem)
+{
+    inter_link_buf_t *buf;
+    buf = (inter_link_buf_t *) calloc(1, sizeof(inter_link_buf_t));
+    buf->max = max_mem > 0? max_mem / (4 * sizeof(uint32_t)) : 0;
+    buf->m = MIN(buf->max, 1 << 16);
+    if (buf->m)
+        buf->a = (uint32_t *) malloc(buf->m * 4 * sizeof(uint32_t));
+    return buf;
+}
+
+static inline void inter_link_buf_push(inter_link_buf_t *buf, const uint32_t *r)
+{
+    if (!buf->a)
+        return;
+    if (buf->n == buf->m) {
+        if (buf->m >= buf->max) {
+            // over the memory limit, give up buffering
+            free(buf->a);
+            buf->a = 0;
+            buf->n = buf->m = 0;
+            return;
+        }
+        buf->m = MIN(buf->max, buf->m << 1);
+        buf->a = (uint32_t *) realloc(buf->a, buf->m * 4 * sizeof(uint32_t));
     }
-    if (s > 0)
-        i /= f;
-    else
-        i *= f;
-    *l = i;
+    memcpy(buf->a + buf->n * 4, r, 4 * sizeof(uint32_t));
+    ++buf->n;
 }
 
-intra_link_mat_t *intra_link_mat_from_file(const char *f, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, int use_gap_seq)
+// encode an inter-scaffold link as [seq0, seq1, end0 << 31 | band0, end1 << 31 | band1], seq0 < seq1
+// end is 1 if the read is on the second half of the scaffold and band is counted from that end
+// return 0 if either scaffold is too short to get a cell in the inter link matrix
+static inline int inter_link_encode(asm_dict_t *dict, uint32_t resolution, uint32_t i0, uint64_t p0, uint32_t i1, uint64_t p1, uint32_t *r)
 {
-    uint32_t i, j, n, b0, b1;
-    uint32_t buffer[BUFF_SIZE], k, m, i0, i1;
-    uint64_t p0, p1;
-    long pair_c, intra_c;
-    intra_link_mat_t *link_mat;
-    intra_link_t *link;
-    FILE *fp;
+    double l0, l1;
 
-    fp = fopen(f, "r");
-    if (fp == NULL)
+    if (i0 > i1) {
+        SWAP(uint32_t, i0, i1);
+        SWAP(uint64_t, p0, p1);
+    }
+    if (dict->s[i0].len < resolution * 2 || dict->s[i1].len < resolution * 2)
         return 0;
 
-    link_mat = use_gap_seq? intra_link_mat_init(dict, re_cuts, resolution) : intra_link_mat_init_sdict(dict->sdict, re_cuts, resolution);
+    l0 = dict->s[i0].len / 2.;
+    l1 = dict->s[i1].len / 2.;
+    r[0] = i0;
+    r[1] = i1;
+    r[2] = p0 >= l0? (uint32_t) ((2 * l0 - p0) / resolution) | 1U << 31 : (uint32_t) ((double) p0 / resolution);
+    r[3] = p1 >= l1? (uint32_t) ((2 * l1 - p1) / resolution) | 1U << 31 : (uint32_t) ((double) p1 / resolution);
 
-    pair_c = 0;
-    intra_c = 0;
+    return 1;
+}
 
-    while (1) {
-        m = fread(&buffer, sizeof(uint32_t), BUFF_SIZE, fp);
-        for (i = 0; i < m; i += 4) {
-            if (use_gap_seq) {
-                sd_coordinate_conversion(dict, buffer[i], buffer[i + 1], &i0, &p0, 0);
-                sd_coordinate_conversion(dict, buffer[i + 2], buffer[i + 3], &i1, &p1, 0);
-                b0 = (MAX(p0, 1) - 1) / resolution;
-                b1 = (MAX(p1, 1) - 1) / resolution;
-            } else {
-                i0 = buffer[i];
-                i1 = buffer[i + 2];
-                b0 = (MAX(buffer[i + 1], 1) - 1) / resolution;
-                b1 = (MAX(buffer[i + 3], 1) - 1) / resolution;
-            }
+// relative area of cell (l0, l1) of sequence pair (i, j) scaled by the restriction site density, 0 if too small
+static inline double inter_link_cell_area(inter_link_mat_t *link_mat, uint32_t i, uint32_t j, uint32_t l0, uint32_t l1)
+{
+    double a, re;
+
+    a = 1.;
+    if (l0 == link_mat->bn[i] - 1)
+        a *= link_mat->ba[i];
+    if (l1 == link_mat->bn[j] - 1)
+        a *= link_mat->ba[j];
+    if (a < .5)
+        a = .0;
+    re = link_mat->re_dens? link_mat->re_dens[i][l0] * link_mat->re_dens[j][l1] : 1.;
+    a *= re < MIN_RE_DENS? .0 : re;
+    return a < FLT_EPSILON? .0 : a;
+}
 
-            if (i0 == i1) {
-                ++intra_c;
-                link = &link_mat->links[i0];
-                if (link->n) {
-                    if (b0 > b1)
-                        SWAP(uint32_t, b0, b1);
-                    k = (long) (link->n * 2 - b1 + b0 - 3) * (b1 - b0) / 2 + b1;
-                    link->link[k] += signf(link->link[k]);
-                }
-            }
+// cells of sequence pair (i, j), i < j, allocated on the first call
+static inline uint32_t *inter_link_mat_get(inter_link_mat_t *link_mat, uint32_t i, uint32_t j)
+{
+    int absent;
+    uint32_t k, b0, b1, p;
+    uint64_t q;
+    khint_t x;
+    khash_t(pair) *h;
+    pair_cell_t key = {0, 0};
+    inter_link_t *link;
+
+    h = (khash_t(pair) *) link_mat->h;
+    key.key = (uint64_t) i << 32 | j;
+    x = kh_put(pair, h, key, &absent);
+    if (!absent)
+        return kh_key(h, x).cell;
+
+    if (link_mat->n == link_mat->m) {
+        link_mat->m = link_mat->m? link_mat->m << 1 : 16;
+        link_mat->links = (inter_link_t *) realloc(link_mat->links, (uint64_t) link_mat->m * sizeof(inter_link_t));
+    }
+    link = &link_mat->links[link_mat->n++];
+
+    b0 = link_mat->bn[i];
+    b1 = link_mat->bn[j];
+    q = inter_link_pair_cells(b0, b1, link_mat->r);
+    p = q;
+    link->c0 = i;
+    link->c1 = j;
+    link->b0 = b0;
+    link->b1 = b1;
+    link->r = MIN(link_mat->r, (uint32_t) (b0 + b1 - 1));
+    link->n = p;
+    link->n0 = 0;
+    link->linkt = 0;
+    assert(p == q);
+    link->link[0] = (uint32_t *) calloc((uint64_t) p * 4, sizeof(uint32_t));
+    for (k = 0; k < 4; ++k) {
+        link->link[k] = link->link[0] + (uint64_t) p * k;
+        link->linkb[k] = (double *) calloc(link->r, sizeof(double));
+    }
+    kh_key(h, x).cell = link->link[0];
+    memset(link->norms, 0, sizeof(link->norms));
+
+    return link->link[0];
+}
+
+// cells of sequence pair (i, j), i < j, NULL if not allocated yet
+static inline uint32_t *inter_link_mat_find(inter_link_mat_t *link_mat, uint32_t i, uint32_t j)
+{
+    khint_t x;
+    khash_t(pair) *h;
+    pair_cell_t key = {0, 0};
+
+    h = (khash_t(pair) *) link_mat->h;
+    key.key = (uint64_t) i << 32 | j;
+    x = kh_get(pair, h, key);
+    return x == kh_end(h)? 0 : kh_key(h, x).cell;
+}
+
+// cell of record r, NULL if out of radius, or if the pair has no cells yet and alloc is not set
+static inline uint32_t *inter_link_cell(inter_link_mat_t *link_mat, const uint32_t *r, uint32_t radius, int alloc)
+{
+    uint32_t b0, b1, n0, n1, t, *cell;
+
+    b0 = r[2] & 0x7FFFFFFF;
+    b1 = r[3] & 0x7FFFFFFF;
+    n0 = link_mat->bn[r[0]];
+    n1 = link_mat->bn[r[1]];
+    if (b0 < n0 && b1 < n1 && b0 + b1 < radius) {
+        cell = alloc? inter_link_mat_get(link_mat, r[0], r[1]) : inter_link_mat_find(link_mat, r[0], r[1]);
+        if (cell == 0)
+            return 0;
+        // link[0]: i0(-) -> i1(+)
+        // link[1]: i0(-) -> i1(-)
+        // link[2]: i0(+) -> i1(+)
+        // link[3]: i0(+) -> i1(-)
+        t = (r[2] >> 31? 0 : 2) | r[3] >> 31;
+        radius = MIN(radius, n0 + n1 - 1);
+        return &cell[inter_link_pair_cells(n0, n1, radius) * t + inter_link_cell_index(n1, radius, MAX(1, b0) - 1, b1)];
+    }
+    return 0;
+}
+
+static inline void inter_link_acc_add(inter_link_acc_t *acc, const uint32_t *r)
+{
+    uint32_t *cell;
+    cell = inter_link_cell(acc->link_mat, r, acc->radius, 1);
+    if (cell) {
+        *cell += r[4];
+        acc->radius_c += r[4];
+    }
+}
+
+// n_bkt: number of buckets, 0 to pick by the matrix size and the number of threads, 1 to add records straight away
+inter_link_acc_t *inter_link_acc_init(inter_link_mat_t *link_mat, uint32_t radius, int n_bkt, int n_threads)
+{
+    uint32_t i;
+    uint64_t bytes, *nb;
+    inter_link_acc_t *acc;
+
+    if (n_bkt <= 0) {
+        // about INTER_ACC_BKT_SIZE bytes of the matrix per bucket if all pairs were linked
+        nb = (uint64_t *) calloc(link_mat->r + 1, sizeof(uint64_t));
+        for (i = 0; i < link_mat->n_seq; ++i)
+            ++nb[link_mat->bn[i]];
+        bytes = inter_link_all_pair_cells(nb, link_mat->r) * 4 * sizeof(uint32_t);
+        free(nb);
+        for (n_bkt = 1; n_bkt < INTER_ACC_MAX_BKT && (uint64_t) n_bkt * INTER_ACC_BKT_SIZE < bytes; n_bkt <<= 1);
+        // buckets are added in parallel
+        if (n_threads > 1)
+            while (n_bkt < INTER_ACC_MAX_BKT && n_bkt < n_threads * 4)
+                n_bkt <<= 1;
+    }
+
+    acc = (inter_link_acc_t *) calloc(1, sizeof(inter_link_acc_t));
+    acc->link_mat = link_mat;
+    acc->radius = radius;
+    acc->n_bkt = n_bkt;
+    acc->n_threads = n_threads;
+    if (n_bkt > 1) {
+        while (acc->shift < 32 && (uint64_t) (MAX(link_mat->n_seq, 1) - 1) >> acc->shift >= (uint64_t) n_bkt)
+            ++acc->shift;
+        acc->m = INTER_ACC_WINDOW;
+        acc->a = (uint32_t *) malloc((uint64_t) acc->m * 5 * sizeof(uint32_t));
+        acc->b = (uint32_t *) malloc((uint64_t) acc->m * 5 * sizeof(uint32_t));
+        acc->off = (uint32_t *) malloc((n_bkt + 1) * sizeof(uint32_t));
+        if (n_threads > 1) {
+            acc->cell = (uint32_t **) malloc((uint64_t) acc->m * sizeof(uint32_t *));
+            acc->bkt_c = (long *) malloc(n_bkt * sizeof(long));
         }
-        pair_c += m / 4;
+    }
+    return acc;
+}
 
-        if (m < BUFF_SIZE) {
-            if (ferror(fp))
-                return 0;
-            break;
+void inter_link_acc_destroy(inter_link_acc_t *acc)
+{
+    free(acc->a);
+    free(acc->b);
+    free(acc->off);
+    free(acc->cell);
+    free(acc->bkt_c);
+    free(acc);
+}
+
+// look up the cells of the records in bucket k, all pairs are read only
+static void inter_link_acc_find(void *data, long k, int tid)
+{
+    inter_link_acc_t *acc = (inter_link_acc_t *) data;
+    uint32_t i;
+
+    for (i = k? acc->off[k - 1] : 0; i < acc->off[k]; ++i)
+        acc->cell[i] = inter_link_cell(acc->link_mat, acc->b + (uint64_t) i * 5, acc->radius, 0);
+}
+
+// add the records in bucket k, the cells of a bucket are not shared with any other bucket
+static void inter_link_acc_add_bkt(void *data, long k, int tid)
+{
+    inter_link_acc_t *acc = (inter_link_acc_t *) data;
+    uint32_t i, w;
+    long c;
+
+    c = 0;
+    for (i = k? acc->off[k - 1] : 0; i < acc->off[k]; ++i) {
+        if (acc->cell[i]) {
+            w = acc->b[(uint64_t) i * 5 + 4];
+            *acc->cell[i] += w;
+            c += w;
         }
     }
-#ifdef DEBUG
-    printf("[I::%s] %ld read pairs processed, %ld intra links \n", __func__, pair_c, intra_c);
-#endif
-    fclose(fp);
+    acc->bkt_c[k] = c;
+}
 
-    // normalise links by cell size
-    for (i = 0; i < link_mat->n; ++i) {
-        link = &link_mat->links[i];
-        n = link->n;
-        if (n == 0)
-            continue;
-        n = (long) n * (n + 1) / 2;
-        for (j = 0; j < n; ++j)
-            normalise_by_size(&link->link[j]);
+// partition the records held by the first sequence with a stable counting sort and add them bucket by bucket
+// records of the same cell keep their order, so the sums do not depend on the number of buckets
+// with multiple threads, the cells are looked up and the buckets added in parallel; cells of pairs
+// not seen before are allocated in between by a single thread
+void inter_link_acc_flush(inter_link_acc_t *acc)
+{
+    uint32_t i, k, n, *off;
+
+    n = acc->n;
+    if (n == 0)
+        return;
+    off = acc->off;
+    memset(off, 0, (acc->n_bkt + 1) * sizeof(uint32_t));
+    for (i = 0; i < n; ++i)
+        ++off[(acc->a[(uint64_t) i * 5] >> acc->shift) + 1];
+    for (k = 0; k < acc->n_bkt; ++k)
+        off[k + 1] += off[k];
+    for (i = 0; i < n; ++i) {
+        k = acc->a[(uint64_t) i * 5] >> acc->shift;
+        memcpy(acc->b + (uint64_t) off[k]++ * 5, acc->a + (uint64_t) i * 5, 5 * sizeof(uint32_t));
     }
+    // off[k] is now the end of bucket k
+    if (acc->n_threads > 1) {
+        kt_for(acc->n_threads, inter_link_acc_find, acc, acc->n_bkt);
+        for (i = 0; i < n; ++i)
+            if (acc->cell[i] == 0)
+                acc->cell[i] = inter_link_cell(acc->link_mat, acc->b + (uint64_t) i * 5, acc->radius, 1);
+        kt_for(acc->n_threads, inter_link_acc_add_bkt, acc, acc->n_bkt);
+        for (k = 0; k < acc->n_bkt; ++k)
+            acc->radius_c += acc->bkt_c[k];
+    } else {
+        for (i = 0; i < n; ++i)
+            inter_link_acc_add(acc, acc->b + (uint64_t) i * 5);
+    }
+    acc->n = 0;
+}
 
-    return link_mat;
+// r: encoded link [seq0, seq1, end0 << 31 | band0, end1 << 31 | band1, count]
+void inter_link_acc_push(inter_link_acc_t *acc, const uint32_t *r)
+{
+    if (r[0] < acc->link_mat->s0 || r[0] >= acc->link_mat->s1)
+        return;
+    if (acc->n_bkt == 1) {
+        inter_link_acc_add(acc, r);
+        return;
+    }
+    memcpy(acc->a + (uint64_t) acc->n * 5, r, 5 * sizeof(uint32_t));
+    if (++acc->n == acc->m)
+        inter_link_acc_flush(acc);
 }
 
-inter_link_mat_t *inter_link_mat_from_file(const char *f, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius)
+/* link matrices are filled in batches of record spans
+ * the chunks of a batch are converted to intra cells or encoded inter links in parallel,
+ * and then added with each cell seeing its records in file order, so the result does not
+ * depend on the number of threads; intra cells are added in parallel by partitions of the
+ * sequences owning them, inter links in parallel by the buckets of the accumulator
+ */
+typedef struct {
+    uint32_t m; // number of uint32 words in the span
+    const uint32_t *a; // records
+    const uint32_t *c; // cell counts if read from a contact cache
+    uint32_t *buf; // copy of the records for multithreading, or the records decoded from a block
+    const uint8_t *data; // encoded block of a block-compressed BIN file, decoded by the chunk worker
+    uint32_t size, n_rec; // bytes and records of the block
+    uint8_t *raw; // copy of the block for multithreading if the file is not memory-mapped
+    uint32_t m_raw;
+    bin_rec_t *blk; // decoded block
+    uint32_t *sid;
+    uint64_t *spos;
+    uint32_t **cell; // cell of each record, NULL if none
+    double **band, *area; // intra band beyond MAX_BAND of each record and the cell area, NULL if none
+    uint32_t n_inter, *inter; // encoded inter-scaffold links and their counts [5 x n_inter]
+    uint32_t *own; // partition of the sequence owning the cell or band of each record, n_part if none
+    uint32_t *off, *idx; // records with a cell or band sorted by partition [n_part + 1], [m / 4]
+    long link_c;
+} link_chunk_t;
+
+typedef struct {
+    asm_dict_t *dict;
+    bin_reader_t *fp;
+    uint32_t resolution;
+    int use_gap_seq;
+    intra_link_mat_t *intra;
+    int buff_inter; // collect inter-scaffold links
+    int n_threads;
+    int n_chunk, n_apply; // number of chunks and those being added
+    uint32_t n_part; // partitions of sequences for adding intra cells, sequence i in i % n_part
+    link_chunk_t *chunk;
+} link_batch_t;
+
+static link_batch_t *link_batch_init(asm_dict_t *dict, uint32_t resolution, int n_threads, int buff_inter, int cell)
 {
-    uint32_t i, j, n, k, b0, b1;
-    uint32_t buffer[BUFF_SIZE], m, i0, i1;
-    uint64_t p0, p1;
-    double l0, l1, a, na[4], nc[4];
-    long pair_c, inter_c, radius_c, noise_c;
-    inter_link_mat_t *link_mat;
-    inter_link_t *link;
-    FILE *fp;
+    int i;
+    link_batch_t *b;
+    link_chunk_t *c;
+
+    b = (link_batch_t *) calloc(1, sizeof(link_batch_t));
+    b->dict = dict;
+    b->resolution = resolution;
+    b->buff_inter = buff_inter;
+    b->n_threads = n_threads;
+    b->n_chunk = n_threads > 1? n_threads * 4 : 1;
+    b->n_part = cell? b->n_chunk : 1;
+    b->chunk = (link_chunk_t *) calloc(b->n_chunk, sizeof(link_chunk_t));
+    for (i = 0; i < b->n_chunk; ++i) {
+        c = &b->chunk[i];
+        if (b->n_chunk > 1)
+            c->buf = (uint32_t *) malloc(BIN_BLOCK_SIZE * 4 * sizeof(uint32_t));
+        c->sid = (uint32_t *) malloc(BIN_BLOCK_SIZE * 2 * sizeof(uint32_t));
+        c->spos = (uint64_t *) malloc(BIN_BLOCK_SIZE * 2 * sizeof(uint64_t));
+        if (cell) {
+            c->cell = (uint32_t **) malloc(BIN_BLOCK_SIZE * sizeof(uint32_t *));
+            c->band = (double **) malloc(BIN_BLOCK_SIZE * sizeof(double *));
+            c->area = (double *) malloc(BIN_BLOCK_SIZE * sizeof(double));
+            if (b->n_part > 1) {
+                c->own = (uint32_t *) malloc(BIN_BLOCK_SIZE * sizeof(uint32_t));
+                c->off = (uint32_t *) malloc((b->n_part + 1) * sizeof(uint32_t));
+                c->idx = (uint32_t *) malloc(BIN_BLOCK_SIZE * sizeof(uint32_t));
+            }
+        }
+        if (buff_inter)
+            c->inter = (uint32_t *) malloc(BIN_BLOCK_SIZE * 5 * sizeof(uint32_t));
+    }
+    return b;
+}
 
-    fp = fopen(f, "r");
-    if (fp == NULL)
-        return 0;
+static void link_batch_destroy(link_batch_t *b)
+{
+    int i;
+    for (i = 0; i < b->n_chunk; ++i) {
+        free(b->chunk[i].buf);
+        free(b->chunk[i].raw);
+        free(b->chunk[i].blk);
+        free(b->chunk[i].sid);
+        free(b->chunk[i].spos);
+        free(b->chunk[i].cell);
+        free(b->chunk[i].band);
+        free(b->chunk[i].area);
+        free(b->chunk[i].inter);
+        free(b->chunk[i].own);
+        free(b->chunk[i].off);
+        free(b->chunk[i].idx);
+    }
+    free(b->chunk);
+    free(b);
+}
 
-    n = dict->n;
-    link_mat = inter_link_mat_init(dict, re_cuts, resolution, radius);
-    pair_c = inter_c = radius_c = 0;
+// fill the batch with the next spans, return the number of chunks filled
+// blocks of a block-compressed BIN file are handed to the chunks as they are and decoded by the chunk workers
+static int link_batch_read(link_batch_t *b, bin_reader_t *fp, contact_cache_t *cc, uint64_t *ci)
+{
+    int n;
+    uint32_t m, size;
+    const uint32_t *a, *cnt;
+    const uint8_t *data;
+    link_chunk_t *c;
+
+    b->fp = fp;
+    for (n = 0; n < b->n_chunk; ++n) {
+        if (fp && (fp->flags & BIN_FLAG_BLOCK)) {
+            m = bin_read_block_data(fp, &data, &size);
+            if (m == 0)
+                break;
+            c = &b->chunk[n];
+            if (b->n_chunk > 1 && !fp->map) {
+                // block data of the reader are only valid until the next read
+                if (size > c->m_raw) {
+                    c->m_raw = size;
+                    c->raw = (uint8_t *) realloc(c->raw, c->m_raw);
+                }
+                memcpy(c->raw, data, size);
+                data = c->raw;
+            }
+            if (c->blk == 0) {
+                c->blk = (bin_rec_t *) malloc(BIN_BLOCK_SIZE * sizeof(bin_rec_t));
+                if (c->buf == 0)
+                    c->buf = (uint32_t *) malloc(BIN_BLOCK_SIZE * 4 * sizeof(uint32_t));
+            }
+            c->data = data;
+            c->size = size;
+            c->n_rec = m;
+            c->m = 0;
+            c->a = c->buf;
+            c->c = 0;
+            continue;
+        }
+        cnt = 0;
+        m = cc? contact_cache_read(cc, ci, &a, &cnt) : bin_read_pairs(fp, &a);
+        if (m == 0)
+            break;
+        c = &b->chunk[n];
+        if (c->buf && !cc) {
+            // spans of the reader are only valid until the next read
+            memcpy(c->buf, a, m * sizeof(uint32_t));
+            a = c->buf;
+        }
+        c->data = 0;
+        c->m = m;
+        c->a = a;
+        c->c = cnt;
+    }
+    return n;
+}
 
-    while (1) {
-        m = fread(&buffer, sizeof(uint32_t), BUFF_SIZE, fp);
-        for (i = 0; i < m; i += 4) {
-            sd_coordinate_conversion(dict, buffer[i], buffer[i + 1], &i0, &p0, 0);
-            sd_coordinate_conversion(dict, buffer[i + 2], buffer[i + 3], &i1, &p1, 0);
+static inline void link_chunk_decode(link_batch_t *b, link_chunk_t *c)
+{
+    if (c->data)
+        c->m = bin_decode_pairs(b->fp, c->data, c->size, c->n_rec, c->blk, c->buf);
+}
 
-            if (i0 != i1) {
-                ++inter_c;
-                
-                if (i0 > i1) {
-                    SWAP(uint32_t, i0, i1);
-                    SWAP(uint64_t, p0, p1);
-                }
+static inline void link_chunk_apply(link_chunk_t *c, uint32_t j)
+{
+    if (c->cell[j])
+        *c->cell[j] += c->c? c->c[j] : 1;
+    else if (c->band && c->band[j])
+        *c->band[j] += (c->c? c->c[j] : 1) / c->area[j];
+}
 
-                link = &link_mat->links[(long) (n * 2 - i0 - 3) * i0 / 2 + i1 - 1];
+// add the records of the batch owned by partition p, chunk by chunk in record order
+static void link_batch_apply_part(void *data, long p, int tid)
+{
+    link_batch_t *b = (link_batch_t *) data;
+    link_chunk_t *c;
+    uint32_t k;
+    int i;
 
-                if (link->n == 0)
-                    continue;
+    for (i = 0; i < b->n_apply; ++i) {
+        c = &b->chunk[i];
+        for (k = c->off[p]; k < c->off[p + 1]; ++k)
+            link_chunk_apply(c, c->idx[k]);
+    }
+}
 
-                l0 = dict->s[i0].len / 2.;
-                l1 = dict->s[i1].len / 2.;
-                
-                if (p0 >= l0 && p1 < l1) {
-                    // i0(-) -> i1(+)
-                    b0 = (uint32_t) ((2 * l0 - p0) / resolution);
-                    b1 = (uint32_t) ((double) p1 / resolution);
-                    if (b0 < link->b0 && b1 < link->b1 && b0 + b1 < radius) {
-                        k = (long) (MAX(1, b0) - 1) * link->b1 + b1;
-                        link->link[0][k] += signf(link->link[0][k]);
-                        ++radius_c;
-                    }
-                } else if(p0 >= l0 && p1 >= l1) {
-                    // i0(-) -> i1(-)
-                    b0 = (uint32_t) ((2 * l0 - p0) / resolution);
-                    b1 = (uint32_t) ((2 * l1 - p1) / resolution);
-                    if (b0 < link->b0 && b1 < link->b1 && b0 + b1 < radius) {
-                        k = (long) (MAX(1, b0) - 1) * link->b1 + b1;
-                        link->link[1][k] += signf(link->link[1][k]);
-                        ++radius_c;
-                    }
-                } else if(p0 < l0 && p1 < l1) {
-                    // i0(+) -> i1(+)
-                    b0 = (uint32_t) ((double) p0 / resolution);
-                    b1 = (uint32_t) ((double) p1 / resolution);
-                    if (b0 < link->b0 && b1 < link->b1 && b0 + b1 < radius) {
-                        k = (long) (MAX(1, b0) - 1) * link->b1 + b1;
-                        link->link[2][k] += signf(link->link[2][k]);
-                        ++radius_c;
-                    }
-                } else if(p0 < l0 && p1 >= l1) {
-                    // i0(+) -> i1(-)
-                    b0 = (uint32_t) ((double) p0 / resolution);
-                    b1 = (uint32_t) ((2 * l1 - p1) / resolution);
-                    if (b0 < link->b0 && b1 < link->b1 && b0 + b1 < radius) {
-                        k = (long) (MAX(1, b0) - 1) * link->b1 + b1;
-                        link->link[3][k] += signf(link->link[3][k]);
-                        ++radius_c;
+// add the counts of the batch to the intra cells in record order
+static void link_batch_apply(link_batch_t *b, int n, inter_link_buf_t *inter)
+{
+    int i;
+    uint32_t j, m;
+    link_chunk_t *c;
+
+    if (b->n_part > 1) {
+        b->n_apply = n;
+        kt_for(b->n_threads, link_batch_apply_part, b, b->n_part);
+    } else {
+        for (i = 0; i < n; ++i) {
+            c = &b->chunk[i];
+            m = c->m / 4;
+            for (j = 0; j < m; ++j)
+                link_chunk_apply(c, j);
+        }
+    }
+    if (inter)
+        for (i = 0; i < n; ++i)
+            for (j = 0; j < b->chunk[i].n_inter; ++j)
+                inter_link_buf_push(inter, b->chunk[i].inter + j * 5);
+}
+
+static void intra_link_chunk(void *data, long i_chunk, int tid)
+{
+    link_batch_t *b = (link_batch_t *) data;
+    link_chunk_t *c = &b->chunk[i_chunk];
+    asm_dict_t *dict = b->dict;
+    uint32_t i, m, k, b0, b1, i0, i1, t, x, resolution, *cell;
+    uint64_t p0, p1;
+    const uint32_t *buffer;
+    double a, *band;
+    intra_link_t *link;
+
+    link_chunk_decode(b, c);
+    buffer = c->a;
+    m = c->m;
+    resolution = b->resolution;
+    c->link_c = 0;
+    c->n_inter = 0;
+    if (b->use_gap_seq)
+        sd_coordinate_conversion_pairs(dict, buffer, m / 4, c->sid, c->spos, 0);
+    for (i = 0; i < m; i += 4) {
+        if (b->use_gap_seq) {
+            i0 = c->sid[i / 2];
+            p0 = c->spos[i / 2];
+            i1 = c->sid[i / 2 + 1];
+            p1 = c->spos[i / 2 + 1];
+        } else {
+            i0 = buffer[i];
+            p0 = buffer[i + 1];
+            i1 = buffer[i + 2];
+            p1 = buffer[i + 3];
+        }
+        b0 = (MAX(p0, 1) - 1) / resolution;
+        b1 = (MAX(p1, 1) - 1) / resolution;
+
+        cell = 0;
+        band = 0;
+        if (i0 == i1) {
+            c->link_c += c->c? c->c[i / 4] : 1;
+            link = &b->intra->links[i0];
+            if (link->n) {
+                if (b0 > b1)
+                    SWAP(uint32_t, b0, b1);
+                k = (long) (link->n * 2 - b1 + b0 - 3) * (b1 - b0) / 2 + b1;
+                if (k < intra_link_cells(link->n)) {
+                    cell = &link->link[k];
+                } else {
+                    // the band t of index k, as read by calc_norms
+                    t = intra_link_band(link->n, k);
+                    x = k - intra_link_band_start(link->n, t);
+                    // the last cell of each band is not used for norms
+                    if (x + t < link->n - 1) {
+                        a = intra_link_cell_area(b->intra, i0, x, x + t);
+                        if (a > 0) {
+                            band = &link->d[t - MAX_BAND];
+                            c->area[i / 4] = a;
+                        }
                     }
                 }
             }
+        } else if (b->buff_inter && inter_link_encode(dict, resolution, i0, p0, i1, p1, c->inter + c->n_inter * 5)) {
+            ++c->n_inter;
         }
-        pair_c += m / 4;
+        c->cell[i / 4] = cell;
+        c->band[i / 4] = band;
+        if (c->own)
+            c->own[i / 4] = cell || band? i0 % b->n_part : b->n_part;
+    }
 
-        if (m < BUFF_SIZE) {
-            if (ferror(fp))
-                return 0;
-            break;
+    if (c->own) {
+        // records with a cell or band grouped by partition with a stable counting sort
+        memset(c->off, 0, (b->n_part + 1) * sizeof(uint32_t));
+        for (i = 0; i < m / 4; ++i)
+            if (c->own[i] < b->n_part)
+                ++c->off[c->own[i] + 1];
+        for (k = 0; k < b->n_part; ++k)
+            c->off[k + 1] += c->off[k];
+        for (i = 0; i < m / 4; ++i)
+            if (c->own[i] < b->n_part)
+                c->idx[c->off[c->own[i]]++] = i;
+        for (k = b->n_part; k > 0; --k)
+            c->off[k] = c->off[k - 1];
+        c->off[0] = 0;
+    }
+}
+
+static void inter_link_chunk(void *data, long i_chunk, int tid)
+{
+    link_batch_t *b = (link_batch_t *) data;
+    link_chunk_t *c = &b->chunk[i_chunk];
+    asm_dict_t *dict = b->dict;
+    uint32_t i, m, i0, i1, w, *r;
+    uint64_t p0, p1;
+
+    link_chunk_decode(b, c);
+    m = c->m;
+    c->link_c = 0;
+    c->n_inter = 0;
+    sd_coordinate_conversion_pairs(dict, c->a, m / 4, c->sid, c->spos, 0);
+    for (i = 0; i < m; i += 4) {
+        i0 = c->sid[i / 2];
+        p0 = c->spos[i / 2];
+        i1 = c->sid[i / 2 + 1];
+        p1 = c->spos[i / 2 + 1];
+
+        if (i0 != i1) {
+            w = c->c? c->c[i / 4] : 1;
+            c->link_c += w;
+            r = c->inter + c->n_inter * 5;
+            if (inter_link_encode(dict, b->resolution, i0, p0, i1, p1, r)) {
+                r[4] = w;
+                ++c->n_inter;
+            }
         }
     }
+}
+
+intra_link_mat_t *intra_link_mat_from_file(const char *f, contact_cache_t *cc, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, int use_gap_seq, uint8_t mq, inter_link_buf_t *inter, int n_threads)
+{
+    uint64_t ci;
+    int k, n_chunk;
+    long pair_c, intra_c;
+    intra_link_mat_t *link_mat;
+    link_batch_t *batch;
+    bin_reader_t *fp;
 
+    // inter-scaffold links are only collected on scaffold coordinates
+    if (!use_gap_seq)
+        inter = 0;
+    fp = cc? 0 : bin_reader_open(f, dict->sdict, mq);
+    // pairs between different sequences cannot be intra-scaffold
+    if (fp && !inter && (!use_gap_seq || asm_single_seq_scaffolds(dict)))
+        bin_reader_intra(fp);
+
+    link_mat = use_gap_seq? intra_link_mat_init(dict, re_cuts, resolution) : intra_link_mat_init_sdict(dict->sdict, re_cuts, resolution);
+
+    batch = link_batch_init(dict, resolution, n_threads, inter != 0, 1);
+    batch->use_gap_seq = use_gap_seq;
+    batch->intra = link_mat;
+
+    pair_c = 0;
+    intra_c = 0;
+    ci = 0;
+    while ((n_chunk = link_batch_read(batch, fp, cc, &ci)) > 0) {
+        kt_for(n_threads, intra_link_chunk, batch, n_chunk);
+        link_batch_apply(batch, n_chunk, inter);
+        for (k = 0; k < n_chunk; ++k) {
+            pair_c += batch->chunk[k].m / 4;
+            intra_c += batch->chunk[k].link_c;
+        }
+    }
 #ifdef DEBUG
-    printf("[I::%s] %ld read pairs processed, %ld inter links \n", __func__, pair_c, inter_c);
-    printf("[I::%s] within radius %d: %ld\n", __func__, radius, radius_c);
+    printf("[I::%s] %ld read pairs processed, %ld intra links \n", __func__, pair_c, intra_c);
+    if (inter)
+        printf("[I::%s] %lu inter links buffered\n", __func__, inter->n);
 #endif
-    fclose(fp);
+    if (fp)
+        bin_reader_close(fp);
+    link_batch_destroy(batch);
 
-    // normalise links by cell size
-    for (i = 0; i < link_mat->n; ++i) {
-        link = &link_mat->links[i];
-        for (j = 0; j < link->n; ++j)
-            for (k = 0; k < 4; ++k)
-                normalise_by_size(&link->link[k][j]);
+    return link_mat;
+}
+
+int dcmp (const void *a, const void *b) {
+   double cmp = *(double *) a - *(double *) b;
+   return cmp > 0? 1 : ( cmp < 0? -1 : 0);
+}
+
+static int inter_link_cmp(const void *a, const void *b)
+{
+    const inter_link_t *x = (const inter_link_t *) a;
+    const inter_link_t *y = (const inter_link_t *) b;
+    if (x->c0 != y->c0)
+        return x->c0 < y->c0? -1 : 1;
+    return (x->c1 > y->c1) - (x->c1 < y->c1);
+}
+
+// pairs (i, j) with a[i] * b[j] >= t, a and b sorted in ascending order
+static uint64_t count_area_pairs(const double *a, uint32_t n_a, const double *b, uint32_t n_b, double t)
+{
+    uint32_t i, j;
+    uint64_t c;
+
+    c = 0;
+    j = n_b;
+    for (i = 0; i < n_a; ++i) {
+        while (j > 0 && a[i] * b[j - 1] >= t)
+            --j;
+        c += n_b - j;
     }
+    return c;
+}
 
-    // calculate noise level
-    noise_c = a = 0;
+typedef struct {
+    double a, d; // relative size and restriction site density of a band
+} re_band_t;
+
+static int re_band_cmp(const void *a, const void *b)
+{
+    double x = ((re_band_t *) a)->a, y = ((re_band_t *) b)->a;
+    return (x > y) - (x < y);
+}
+
+// pairs (i, j) with p[i].a * q[j].a >= .5 and p[i].d * q[j].d >= MIN_RE_DENS
+// p and q sorted by a in ascending order, qd the densities of q in ascending order, bit of size n_q + 1
+static uint64_t count_re_band_pairs(const re_band_t *p, uint32_t n_p, const re_band_t *q, const double *qd, uint32_t n_q, uint32_t *bit)
+{
+    uint32_t i, k, x, l, h, m;
+    uint64_t c;
+
+    memset(bit, 0, (n_q + 1) * sizeof(uint32_t));
+    c = 0;
+    k = 0;
+    for (i = 0; i < n_p; ++i) {
+        // q with a large enough, added in descending order of a, counted by the rank of d
+        while (k < n_q && p[i].a * q[n_q - 1 - k].a >= .5) {
+            l = 0;
+            h = n_q;
+            while (l < h) {
+                m = (l + h) / 2;
+                if (qd[m] < q[n_q - 1 - k].d) l = m + 1;
+                else h = m;
+            }
+            for (x = l + 1; x <= n_q; x += x & -x)
+                ++bit[x];
+            ++k;
+        }
+        // first rank with d large enough
+        l = 0;
+        h = n_q;
+        while (l < h) {
+            m = (l + h) / 2;
+            if (p[i].d * qd[m] < MIN_RE_DENS) l = m + 1;
+            else h = m;
+        }
+        c += k;
+        for (x = l; x > 0; x -= x & -x)
+            c -= bit[x];
+    }
+    return c;
+}
+
+// bands of a set of sequences pooled by band index, for the cell areas with restriction sites
+// a cell has an area if the product of the relative sizes of its bands is at least .5
+// and the product of their densities at least MIN_RE_DENS; only the last band of a sequence may be partial
+typedef struct {
+    uint32_t r;
+    uint32_t *nf, *nh; // number of full bands and last bands of at least half size with each band index
+    double **fd, **hd; // densities of these sorted in ascending order
+    re_band_t **hl; // last bands of at least half size sorted by relative size
+    uint32_t *bit; // scratch for count_re_band_pairs
+} re_pool_t;
+
+static re_pool_t *re_pool_init(inter_link_mat_t *link_mat, const uint32_t *seqs, uint32_t n)
+{
+    uint32_t i, c, b, x, r, m;
+    re_pool_t *pool;
+
+    r = link_mat->r;
+    pool = (re_pool_t *) malloc(sizeof(re_pool_t));
+    pool->r = r;
+    pool->nf = (uint32_t *) calloc(r * 2, sizeof(uint32_t));
+    pool->nh = pool->nf + r;
+    for (i = 0; i < n; ++i) {
+        c = seqs[i];
+        b = link_mat->bn[c];
+        for (x = 0; x < b - 1; ++x)
+            ++pool->nf[x];
+        if (link_mat->ba[c] >= .5)
+            ++pool->nh[b - 1];
+    }
+    pool->fd = (double **) malloc(r * 2 * sizeof(double *));
+    pool->hd = pool->fd + r;
+    pool->hl = (re_band_t **) malloc(r * sizeof(re_band_t *));
+    m = 0;
+    for (x = 0; x < r; ++x) {
+        pool->fd[x] = (double *) malloc(pool->nf[x] * sizeof(double));
+        pool->hd[x] = (double *) malloc(pool->nh[x] * sizeof(double));
+        pool->hl[x] = (re_band_t *) malloc(pool->nh[x] * sizeof(re_band_t));
+        m = MAX(m, pool->nh[x]);
+        pool->nf[x] = pool->nh[x] = 0;
+    }
+    pool->bit = (uint32_t *) malloc((m + 1) * sizeof(uint32_t));
+    for (i = 0; i < n; ++i) {
+        c = seqs[i];
+        b = link_mat->bn[c];
+        for (x = 0; x < b - 1; ++x)
+            pool->fd[x][pool->nf[x]++] = link_mat->re_dens[c][x];
+        if (link_mat->ba[c] >= .5) {
+            x = b - 1;
+            pool->hl[x][pool->nh[x]].a = link_mat->ba[c];
+            pool->hl[x][pool->nh[x]].d = link_mat->re_dens[c][x];
+            pool->hd[x][pool->nh[x]++] = link_mat->re_dens[c][x];
+        }
+    }
+    for (x = 0; x < r; ++x) {
+        qsort(pool->fd[x], pool->nf[x], sizeof(double), dcmp);
+        qsort(pool->hd[x], pool->nh[x], sizeof(double), dcmp);
+        qsort(pool->hl[x], pool->nh[x], sizeof(re_band_t), re_band_cmp);
+    }
+
+    return pool;
+}
+
+static void re_pool_destroy(re_pool_t *pool)
+{
+    uint32_t x;
+
+    for (x = 0; x < pool->r; ++x) {
+        free(pool->fd[x]);
+        free(pool->hd[x]);
+        free(pool->hl[x]);
+    }
+    free(pool->fd);
+    free(pool->hl);
+    free(pool->nf);
+    free(pool->bit);
+    free(pool);
+}
+
+// ordered pairs of bands of p and q with an area on the bands b with s[b] set, or all bands if s is NULL
+// full x full + full x last + last x full + last x last
+static uint64_t re_pool_pairs(re_pool_t *p, re_pool_t *q, const uint8_t *s)
+{
+    uint32_t x, y, r;
+    uint64_t c;
+
+    r = p->r;
+    c = 0;
+    for (x = 0; x < r; ++x) {
+        for (y = 0; y < r; ++y) {
+            if (s && !s[x + y])
+                continue;
+            c += count_area_pairs(p->fd[x], p->nf[x], q->fd[y], q->nf[y], MIN_RE_DENS);
+            c += count_area_pairs(p->fd[x], p->nf[x], q->hd[y], q->nh[y], MIN_RE_DENS);
+            c += count_area_pairs(p->hd[x], p->nh[x], q->fd[y], q->nf[y], MIN_RE_DENS);
+            c += count_re_band_pairs(p->hl[x], p->nh[x], q->hl[y], q->hd[y], q->nh[y], q->bit);
+        }
+    }
+    return c;
+}
+
+// cells with an area over the pairs of sequences in seqs on the bands b with s[b] set, or all bands if s is NULL
+static uint64_t inter_link_re_area(inter_link_mat_t *link_mat, const uint32_t *seqs, uint32_t n, const uint8_t *s)
+{
+    uint32_t i, c, b, x, y;
+    uint64_t t, same;
+    re_pool_t *pool;
+
+    if (n < 2)
+        return 0;
+    // pairs of bands of the same sequence are counted in the pool as well
+    same = 0;
+    for (i = 0; i < n; ++i) {
+        c = seqs[i];
+        b = link_mat->bn[c];
+        for (x = 0; x < b; ++x)
+            for (y = 0; y < b; ++y)
+                if ((!s || s[x + y]) && inter_link_cell_area(link_mat, c, c, x, y) > .0)
+                    ++same;
+    }
+    pool = re_pool_init(link_mat, seqs, n);
+    t = re_pool_pairs(pool, pool, s);
+    re_pool_destroy(pool);
+
+    return (t - same) / 2;
+}
+
+// cells with an area over the pairs (i, j) of sequences, l0 <= i < l1 and h0 <= j < h1, whose first cell has an area
+// the sequences are sorted by the density d of their first band, so the partners of i are those from the first j
+// with d[i] * d[j] >= MIN_RE_DENS, fewer for a smaller d[i]; the pairs are split into full blocks
+static uint64_t inter_link_re_area_stair(inter_link_mat_t *link_mat, const uint32_t *seqs, const double *d, uint32_t l0, uint32_t l1, uint32_t h0, uint32_t h1, const uint8_t *s)
+{
+    uint32_t i, l, h, m;
+    uint64_t c;
+    re_pool_t *p, *q;
+
+    if (l0 >= l1 || h0 >= h1)
+        return 0;
+    i = (l0 + l1) / 2;
+    l = h0;
+    h = h1;
+    while (l < h) {
+        m = (l + h) / 2;
+        if (d[i] * d[m] < MIN_RE_DENS) l = m + 1;
+        else h = m;
+    }
+    c = 0;
+    if (l < h1) {
+        // [i, l1) x [l, h1)
+        p = re_pool_init(link_mat, seqs + i, l1 - i);
+        q = re_pool_init(link_mat, seqs + l, h1 - l);
+        c = re_pool_pairs(p, q, s);
+        re_pool_destroy(p);
+        re_pool_destroy(q);
+    }
+    return c + inter_link_re_area_stair(link_mat, seqs, d, l0, i, l, h1, s) + inter_link_re_area_stair(link_mat, seqs, d, i + 1, l1, h0, l, s);
+}
+
+static int re_seq_cmp(const void *a, const void *b)
+{
+    double x = ((re_band_t *) a)->d, y = ((re_band_t *) b)->d;
+    return (x > y) - (x < y);
+}
+
+// cells with an area over all pairs of sequences, counted as if the pairs had no links
+// na: all cells, as in the noise estimation
+// nb: cells on the bands with positive norms, as in inter_link_norms, for the pairs whose first cell has an area
+static void inter_link_mat_area(inter_link_mat_t *link_mat, const double *norms, uint64_t *na, uint64_t *nb)
+{
+    uint32_t i, x, y, h, n, r, m, *bn, *off, *seqs;
+    uint64_t sx, sx2, sh, sxh, *ns, *nh, *np, *ps, *pp, c, c_self;
+    uint8_t *s;
+    double *a, *as, *d;
+    re_band_t *sq;
+
+    n = link_mat->n_seq;
+    bn = link_mat->bn;
+    *na = *nb = 0;
+    if (link_mat->re_dens) {
+        // cell areas are scaled by the restriction site density of each band
+        // sequences sorted by the density of their first band, which is always full-size
+        sq = (re_band_t *) malloc(n * sizeof(re_band_t));
+        seqs = (uint32_t *) malloc(n * sizeof(uint32_t));
+        m = 0;
+        for (i = 0; i < n; ++i) {
+            if (bn[i] == 0)
+                continue;
+            sq[m].a = i; // sequence index
+            sq[m++].d = link_mat->re_dens[i][0];
+        }
+        qsort(sq, m, sizeof(re_band_t), re_seq_cmp);
+        for (i = 0; i < m; ++i)
+            seqs[i] = (uint32_t) sq[i].a;
+        *na = inter_link_re_area(link_mat, seqs, m, 0);
+
+        r = link_mat->r;
+        if (norms && r > 0 && norms[1] > 0) {
+            s = (uint8_t *) calloc(r * 2, sizeof(uint8_t));
+            for (x = 0; x < r; ++x)
+                s[x] = norms[x + 1] > 0;
+            // a pair is only counted if its first cell has an area; the sequences whose first band has
+            // a density of at least the square root of MIN_RE_DENS all pair with each other, the others
+            // only with some of these and not with each other
+            d = (double *) malloc(m * sizeof(double));
+            for (i = 0; i < m; ++i)
+                d[i] = sq[i].d;
+            h = 0;
+            while (h < m && d[h] * d[h] < MIN_RE_DENS)
+                ++h;
+            *nb = inter_link_re_area(link_mat, seqs + h, m - h, s) + inter_link_re_area_stair(link_mat, seqs, d, 0, h, h, m, s);
+            free(d);
+            free(s);
+        }
+        free(sq);
+        free(seqs);
+        return;
+    }
+
+    // otherwise only the last band of a sequence is partial, and a cell has an area
+    // unless the product of the relative sizes of its two bands is below .5
+    // sequences are grouped by the number of full bands x, each group sorted by the size of the last band
+    r = link_mat->r;
+    off = (uint32_t *) calloc(r + 1, sizeof(uint32_t));
+    for (i = 0; i < n; ++i)
+        if (bn[i])
+            ++off[bn[i]];
+    for (x = 0; x < r; ++x)
+        off[x + 1] += off[x];
+    m = off[r];
+    a = (double *) malloc(m * sizeof(double));
+    for (i = 0; i < n; ++i)
+        if (bn[i])
+            a[off[bn[i] - 1]++] = link_mat->ba[i];
+    for (x = r; x > 0; --x)
+        off[x] = off[x - 1];
+    off[0] = 0;
+
+    // ns[x]: group size; nh[x]: last bands of at least half size; np[x]: sequences paired with themselves
+    ns = (uint64_t *) calloc(r * 3, sizeof(uint64_t));
+    nh = ns + r;
+    np = nh + r;
+    sx = sx2 = sh = sxh = 0;
+    for (x = 0; x < r; ++x) {
+        ns[x] = off[x + 1] - off[x];
+        qsort(a + off[x], ns[x], sizeof(double), dcmp);
+        for (i = off[x]; i < off[x + 1]; ++i) {
+            if (a[i] >= .5)
+                ++nh[x];
+            if (a[i] * a[i] >= .5)
+                ++np[x];
+        }
+        sx += x * ns[x];
+        sx2 += (uint64_t) x * x * ns[x];
+        sh += nh[x];
+        sxh += x * nh[x];
+    }
+    as = (double *) malloc(m * sizeof(double));
+    memcpy(as, a, m * sizeof(double));
+    qsort(as, m, sizeof(double), dcmp);
+    c_self = 0;
+    for (x = 0; x < r; ++x)
+        c_self += np[x];
+    // full x full + last x full + last x last
+    *na = (sx * sx - sx2) / 2 + (sx * sh - sxh) + (count_area_pairs(as, m, as, m, .5) - c_self) / 2;
+    free(as);
+
+    if (norms && r > 0 && norms[1] > 0) {
+        // s[b] = 1 if band b has a positive norm; ps and pp are the first and second order prefix sums of s
+        ps = (uint64_t *) calloc((r * 2 + 1) * 2, sizeof(uint64_t));
+        pp = ps + r * 2 + 1;
+        for (x = 0; x < r * 2; ++x) {
+            ps[x + 1] = ps[x] + (x < r && norms[x + 1] > 0);
+            pp[x + 1] = pp[x] + ps[x];
+        }
+#define S(b) (ps[(b) + 1] - ps[b])
+#define F(x, y) (pp[(x) + (y)] - pp[y] - pp[x]) // cells (l0 < x, l1 < y) with s[l0 + l1] = 1
+#define U(x, y) (ps[(x) + (y)] - ps[x]) // cells (x, l1 < y) with s[x + l1] = 1
+        // ordered pairs including a sequence with itself
+        c = c_self = 0;
+        for (x = 0; x < r; ++x) {
+            if (ns[x] == 0)
+                continue;
+            for (y = 0; y < r; ++y) {
+                if (ns[y] == 0)
+                    continue;
+                c += ns[x] * ns[y] * F(x, y) + nh[x] * ns[y] * U(x, y) + ns[x] * nh[y] * U(y, x);
+                if (S(x + y))
+                    c += count_area_pairs(a + off[x], ns[x], a + off[y], ns[y], .5);
+            }
+            c_self += ns[x] * F(x, x) + nh[x] * U(x, x) * 2;
+            if (S(x * 2))
+                c_self += np[x];
+        }
+#undef S
+#undef F
+#undef U
+        *nb = (c - c_self) / 2;
+        free(ps);
+    }
+
+    free(a);
+    free(ns);
+    free(off);
+}
+
+static void inter_link_mat_sort(inter_link_mat_t *link_mat)
+{
+    kh_destroy(pair, (khash_t(pair) *) link_mat->h);
+    link_mat->h = 0;
+    qsort(link_mat->links, link_mat->n, sizeof(inter_link_t), inter_link_cmp);
+}
+
+// links of each pair in its orientation with the fewest links, summed over pairs
+// the same pass over the cells also adds up the links of each band into linkb for calc_link_directs
+static long inter_link_mat_noise_links(inter_link_mat_t *link_mat)
+{
+    uint32_t i, j, k, b, l0, l1;
+    double a, l, nc[4];
+    long noise_c;
+    inter_link_t *link;
+
+    noise_c = 0;
     for (i = 0; i < link_mat->n; ++i) {
         memset(nc, 0, sizeof(nc));
-        memset(na, 0, sizeof(na));
         link = &link_mat->links[i];
-        for (j = 0; j < link->n; ++j) {
-            for (k = 0; k < 4; ++k) {
-                if (link->link[k][j] >= 0) {
-                    nc[k] += link->link[k][j];
-                    na[k] += 1.;
+        for (l0 = 0, j = 0; l0 < link->b0; ++l0) {
+            for (l1 = 0; l1 < MIN(link->b1, link->r - l0); ++l1, ++j) {
+                a = inter_link_cell_area(link_mat, link->c0, link->c1, l0, l1);
+                if (a == .0)
+                    continue;
+                b = l0 + l1;
+                for (k = 0; k < 4; ++k) {
+                    l = normalise_by_size(link->link[k][j], a);
+                    nc[k] += l;
+                    if (b <= link->b0 && b <= link->b1 && link->link[k][j])
+                        link->linkb[k][b] += l;
                 }
             }
         }
@@ -690,14 +1531,187 @@ inter_link_mat_t *inter_link_mat_from_file(const char *f, asm_dict_t *dict, re_c
             if (nc[k] < nc[j])
                 j = k;
         noise_c += nc[j];
-        a += na[j];
     }
+    return noise_c;
+}
+
+static void inter_link_mat_set_noise(inter_link_mat_t *link_mat, long noise_c)
+{
+    uint64_t area, nb;
+    double a;
+
+    // pairs without links add their cells to the area but no links
+    inter_link_mat_area(link_mat, 0, &area, &nb);
+    a = area;
     link_mat->noise = a > 0? noise_c / a : 0;
 #ifdef DEBUG_NOISE
     printf("[I::%s] noise links: %ld; area: %.12f; noise estimation: %.12f\n", __func__, noise_c, a, link_mat->noise);
 #endif
+}
+
+static void inter_link_mat_finalise(inter_link_mat_t *link_mat)
+{
+    inter_link_mat_sort(link_mat);
+    // calculate noise level
+    inter_link_mat_set_noise(link_mat, inter_link_mat_noise_links(link_mat));
+}
+
+static void inter_link_mat_fill_file(inter_link_mat_t *link_mat, const char *f, contact_cache_t *cc, asm_dict_t *dict, uint32_t resolution, uint8_t mq, int n_threads)
+{
+    uint64_t ci;
+    int k, n_chunk;
+    uint32_t j;
+    long pair_c, inter_c;
+    inter_link_acc_t *acc;
+    link_chunk_t *c;
+    link_batch_t *batch;
+    bin_reader_t *fp;
+
+    fp = cc? 0 : bin_reader_open(f, dict->sdict, mq);
+
+    acc = inter_link_acc_init(link_mat, link_mat->r, 0, n_threads);
+
+    batch = link_batch_init(dict, resolution, n_threads, 1, 0);
+
+    pair_c = inter_c = 0;
+    ci = 0;
+    while ((n_chunk = link_batch_read(batch, fp, cc, &ci)) > 0) {
+        kt_for(n_threads, inter_link_chunk, batch, n_chunk);
+        for (k = 0; k < n_chunk; ++k) {
+            c = &batch->chunk[k];
+            for (j = 0; j < c->n_inter; ++j)
+                inter_link_acc_push(acc, c->inter + j * 5);
+            pair_c += c->m / 4;
+            inter_c += c->link_c;
+        }
+    }
+    inter_link_acc_flush(acc);
+
+#ifdef DEBUG
+    printf("[I::%s] %ld read pairs processed, %ld inter links \n", __func__, pair_c, inter_c);
+    printf("[I::%s] within radius %d: %ld\n", __func__, link_mat->r, acc->radius_c);
+#endif
+    inter_link_acc_destroy(acc);
+    if (fp)
+        bin_reader_close(fp);
+    link_batch_destroy(batch);
+}
+
+static void inter_link_mat_fill_buf(inter_link_mat_t *link_mat, inter_link_buf_t *buf, int n_threads)
+{
+    uint64_t i;
+    uint32_t r[5];
+    inter_link_acc_t *acc;
+
+    acc = inter_link_acc_init(link_mat, link_mat->r, 0, n_threads);
+    r[4] = 1;
+    for (i = 0; i < buf->n; ++i) {
+        memcpy(r, buf->a + i * 4, 4 * sizeof(uint32_t));
+        inter_link_acc_push(acc, r);
+    }
+    inter_link_acc_flush(acc);
+
+#ifdef DEBUG
+    printf("[I::%s] %lu buffered inter links processed\n", __func__, buf->n);
+    printf("[I::%s] within radius %d: %ld\n", __func__, link_mat->r, acc->radius_c);
+#endif
+    inter_link_acc_destroy(acc);
+}
+
+inter_link_mat_t *inter_link_mat_from_file(const char *f, contact_cache_t *cc, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius, uint8_t mq, int n_threads)
+{
+    inter_link_mat_t *link_mat;
+
+    link_mat = inter_link_mat_init(dict, re_cuts, resolution, radius);
+    inter_link_mat_fill_file(link_mat, f, cc, dict, resolution, mq, n_threads);
+    inter_link_mat_finalise(link_mat);
+
+    return link_mat;
+}
+
+inter_link_mat_t *inter_link_mat_from_buf(inter_link_buf_t *buf, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius, int n_threads)
+{
+    inter_link_mat_t *link_mat;
+
+    link_mat = inter_link_mat_init(dict, re_cuts, resolution, radius);
+    inter_link_mat_fill_buf(link_mat, buf, n_threads);
+    inter_link_mat_finalise(link_mat);
+
+    return link_mat;
+}
+
+// split the sequences into tiles [s[i], s[i + 1]) of the first sequence of pairs,
+// each taking at most max_mem bytes if all its pairs were linked unless a single sequence does
+static uint32_t *inter_link_mat_tiles(inter_link_mat_t *link_mat, long max_mem, int *n_tile)
+{
+    uint32_t i, x, y, n, r, *s;
+    uint64_t *nb;
+    long bytes, *rows;
+
+    n = link_mat->n_seq;
+    r = link_mat->r;
+    rows = (long *) malloc(n * sizeof(long));
+    nb = (uint64_t *) calloc(r + 1, sizeof(uint64_t));
+    for (i = n; i > 0; --i) {
+        x = link_mat->bn[i - 1];
+        rows[i - 1] = 0;
+        if (x == 0)
+            continue;
+        for (y = 1; y <= r; ++y)
+            if (nb[y])
+                rows[i - 1] += nb[y] * inter_link_pair_bytes(x, y, r);
+        ++nb[x];
+    }
+
+    s = (uint32_t *) malloc((n + 2) * sizeof(uint32_t));
+    *n_tile = 0;
+    s[0] = 0;
+    bytes = 0;
+    for (i = 0; i < n; ++i) {
+        if (bytes > 0 && bytes + rows[i] > max_mem) {
+            s[++*n_tile] = i;
+            bytes = 0;
+        }
+        bytes += rows[i];
+    }
+    s[++*n_tile] = n;
+    free(rows);
+    free(nb);
+
+    return s;
+}
 
-    return link_mat;
+// an empty matrix for the pairs of sequences [s0, s1), sharing the sequence bands of link_mat
+static inter_link_mat_t *inter_link_mat_tile_init(inter_link_mat_t *link_mat, uint32_t s0, uint32_t s1)
+{
+    inter_link_mat_t *tile;
+
+    tile = (inter_link_mat_t *) calloc(1, sizeof(inter_link_mat_t));
+    tile->r = link_mat->r;
+    tile->h = kh_init(pair);
+    tile->n_seq = link_mat->n_seq;
+    tile->s0 = s0;
+    tile->s1 = s1;
+    tile->bn = link_mat->bn;
+    tile->ba = link_mat->ba;
+    tile->re_dens = link_mat->re_dens;
+
+    return tile;
+}
+
+static void inter_link_mat_tile_fill(inter_link_mat_t *tile, const char *f, contact_cache_t *cc, inter_link_buf_t *buf, asm_dict_t *dict, uint32_t resolution, uint8_t mq, int n_threads)
+{
+    if (buf)
+        inter_link_mat_fill_buf(tile, buf, n_threads);
+    else
+        inter_link_mat_fill_file(tile, f, cc, dict, resolution, mq, n_threads);
+    inter_link_mat_sort(tile);
+}
+
+static void inter_link_mat_tile_destroy(inter_link_mat_t *tile)
+{
+    inter_link_mat_free_pairs(tile);
+    free(tile);
 }
 
 void norm_destroy(norm_t *norm)
@@ -712,17 +1726,186 @@ void norm_destroy(norm_t *norm)
     free(norm);
 }
 
-int dcmp (const void *a, const void *b) {
-   double cmp = *(double *) a - *(double *) b;
-   return cmp > 0? 1 : ( cmp < 0? -1 : 0);
+// k-th smallest element of a, 0-based, leaving no larger elements before it
+static double select_k(double *a, long n, long k)
+{
+    long l, r, i, j;
+    double p;
+
+    l = 0;
+    r = n - 1;
+    while (l < r) {
+        p = a[l + (r - l) / 2];
+        i = l;
+        j = r;
+        while (i <= j) {
+            while (a[i] < p)
+                ++i;
+            while (p < a[j])
+                --j;
+            if (i <= j) {
+                SWAP(double, a[i], a[j]);
+                ++i;
+                --j;
+            }
+        }
+        if (k <= j)
+            r = j;
+        else if (k >= i)
+            l = i;
+        else
+            break;
+    }
+    return a[k];
+}
+
+// k-th smallest count of band i, 0-based, selected by the high and then the low 16 bits
+// lt: number of counts smaller than the one returned
+static uint32_t select_band_count(intra_link_mat_t *link_mat, uint32_t i, uint64_t k, uint64_t *hist, uint64_t *lt)
+{
+    uint32_t j, x, b, h, *cnt;
+
+    memset(hist, 0, 65536 * sizeof(uint64_t));
+    for (j = 0; j < link_mat->n; ++j) {
+        b = link_mat->links[j].n;
+        if (b > i + 1) {
+            cnt = link_mat->links[j].link + intra_link_band_start(b, i);
+            for (x = 0; x < b - 1 - i; ++x)
+                ++hist[cnt[x] >> 16];
+        }
+    }
+    *lt = 0;
+    for (h = 0; *lt + hist[h] <= k; ++h)
+        *lt += hist[h];
+
+    memset(hist, 0, 65536 * sizeof(uint64_t));
+    for (j = 0; j < link_mat->n; ++j) {
+        b = link_mat->links[j].n;
+        if (b > i + 1) {
+            cnt = link_mat->links[j].link + intra_link_band_start(b, i);
+            for (x = 0; x < b - 1 - i; ++x)
+                if (cnt[x] >> 16 == h)
+                    ++hist[cnt[x] & 0xFFFF];
+        }
+    }
+    for (x = 0; *lt + hist[x] <= k; ++x)
+        *lt += hist[x];
+
+    return h << 16 | x;
+}
+
+typedef struct {
+    intra_link_mat_t *link_mat;
+    uint32_t *bs;
+    double *norms, *linkc;
+    void **buf; // scratch of each thread
+} band_norm_t;
+
+// link count and norm of band i
+static void calc_band_norm(void *data, long i, int tid)
+{
+    band_norm_t *d = (band_norm_t *) data;
+    intra_link_mat_t *link_mat = d->link_mat;
+    uint32_t j, k, b, t, x, n, *cnt;
+    uint64_t lt;
+    double tmp_c, *link;
+    intra_link_t *l;
+
+    n = d->bs[i];
+    tmp_c = .0;
+    if (i >= MAX_BAND) {
+        // bands beyond MAX_BAND only have totals, which is all the radius needs
+        for (j = 0; j < link_mat->n; ++j) {
+            l = &link_mat->links[j];
+            if (l->n > i + 1) {
+                tmp_c += l->d[i - MAX_BAND];
+                // cells too small to be normalised, only possible with restriction sites
+                if (link_mat->re_dens)
+                    for (k = 0; k < l->n - 1 - i; ++k)
+                        if (intra_link_cell_area(link_mat, j, k, k + i) == .0)
+                            tmp_c += normalise_by_size(0, .0);
+            }
+        }
+        d->linkc[i] = tmp_c;
+        d->norms[i] = MAX(tmp_c, 1.) / n;
+        return;
+    }
+
+    if (link_mat->re_dens) {
+        if (!d->buf[tid])
+            d->buf[tid] = malloc(d->bs[0] * sizeof(double));
+        link = (double *) d->buf[tid];
+        t = 0;
+        for (j = 0; j < link_mat->n; ++j) {
+            b = link_mat->links[j].n;
+            if (b > i + 1) {
+                cnt = link_mat->links[j].link + intra_link_band_start(b, i);
+                for (k = 0; k < b - 1 - i; ++k)
+                    link[t++] = normalise_by_size(cnt[k], intra_link_cell_area(link_mat, j, k, k + i));
+            }
+        }
+        for (j = 0; j < n; ++j)
+            tmp_c += link[j];
+        d->linkc[i] = tmp_c;
+#ifdef USE_MEDIAN_NORM
+        d->norms[i] = select_k(link, n, n / 2);
+        if (!(n & 1)) {
+            // the next smaller value is the largest one before it
+            tmp_c = link[0];
+            for (j = 1; j < n / 2; ++j)
+                tmp_c = MAX(tmp_c, link[j]);
+            d->norms[i] = (d->norms[i] + tmp_c) / 2;
+        }
+#else
+        d->norms[i] = MAX(tmp_c, 1.) / n;
+#endif
+        return;
+    }
+
+    // without restriction sites the cells of a band have a unit area, so the counts are the values
+    for (j = 0; j < link_mat->n; ++j) {
+        b = link_mat->links[j].n;
+        if (b > i + 1) {
+            cnt = link_mat->links[j].link + intra_link_band_start(b, i);
+            for (k = 0; k < b - 1 - i; ++k)
+                tmp_c += cnt[k];
+        }
+    }
+    d->linkc[i] = tmp_c;
+#ifdef USE_MEDIAN_NORM
+    if (!d->buf[tid])
+        d->buf[tid] = malloc(65536 * sizeof(uint64_t));
+    t = select_band_count(link_mat, i, n / 2, (uint64_t *) d->buf[tid], &lt);
+    d->norms[i] = t;
+    if (!(n & 1)) {
+        // the next smaller count is t as well unless all counts below t fill the lower half
+        k = t;
+        if (lt == n / 2) {
+            k = 0;
+            for (j = 0; j < link_mat->n; ++j) {
+                b = link_mat->links[j].n;
+                if (b > i + 1) {
+                    cnt = link_mat->links[j].link + intra_link_band_start(b, i);
+                    for (x = 0; x < b - 1 - i; ++x)
+                        if (cnt[x] < t && cnt[x] > k)
+                            k = cnt[x];
+                }
+            }
+        }
+        d->norms[i] = ((double) t + k) / 2;
+    }
+#else
+    d->norms[i] = MAX(tmp_c, 1.) / n;
+#endif
 }
 
-norm_t *calc_norms(intra_link_mat_t *link_mat)
+norm_t *calc_norms(intra_link_mat_t *link_mat, int n_threads)
 {
-    uint32_t i, j, n, b, r, r0, t;
+    uint32_t i, j, n, b, r, r0;
     uint32_t *bs;
     double intra_c, tmp_c;
-    double *norms, *link, *linkc;
+    double *norms, *linkc;
+    band_norm_t data;
     norm_t *norm;
     
     // find maximum numebr of bands
@@ -757,33 +1940,18 @@ norm_t *calc_norms(intra_link_mat_t *link_mat)
     // calculate norms - using median or mean?
     norms = (double *) malloc(n * sizeof(double));
     linkc = (double *) malloc(n * sizeof(double));
+    data.link_mat = link_mat;
+    data.bs = bs;
+    data.norms = norms;
+    data.linkc = linkc;
+    data.buf = (void **) calloc(n_threads, sizeof(void *));
+    kt_for(n_threads, calc_band_norm, &data, n);
+    for (i = 0; i < n_threads; ++i)
+        free(data.buf[i]);
+    free(data.buf);
     intra_c = .0;
-    for (i = 0; i < n; ++i) {
-        link = (double *) malloc(bs[i] * sizeof(double));
-        t = 0;
-        for (j = 0; j < link_mat->n; ++j) {
-            b = link_mat->links[j].n;
-            if (b > i + 1) {
-                memcpy(link + t, link_mat->links[j].link + (long) (b * 2 - i - 1) * i / 2 + i, (b - 1 - i) * sizeof(double));
-                t += b - 1 - i;
-            }
-        }
-
-        tmp_c = .0;
-        for (j = 0; j < bs[i]; ++j)
-            tmp_c += link[j];
-        linkc[i] = tmp_c;
-        intra_c += tmp_c;
-        
-#ifdef USE_MEDIAN_NORM
-        qsort(link, bs[i], sizeof(double), dcmp);
-        norms[i] = bs[i] & 1? link[bs[i] / 2] : (link[bs[i] / 2] + link[bs[i] / 2 - 1]) / 2;
-#else
-        norms[i] = MAX(linkc[i], 1.) / bs[i];
-#endif
-
-        free(link);
-    }
+    for (i = 0; i < n; ++i)
+        intra_c += linkc[i];
 
     intra_c -= linkc[0];
     tmp_c = .0;
@@ -918,23 +2086,25 @@ void print_norms(FILE *fp, norm_t *norm)
 
 int estimate_noise(inter_link_mat_t *link_mat)
 {
-    uint32_t i, j, k, n;
+    uint32_t i, j, k, n, l0, l1;
     uint32_t bin, *hist;
     uint64_t total;
-    double l;
+    double a, l;
     inter_link_t *inter_link;
 
     bin = 4096;
     hist = (uint32_t *) calloc(bin, sizeof(uint32_t));
     for (i = 0; i < link_mat->n; ++i) {
         inter_link = &link_mat->links[i];
-        n = inter_link->n;
-        for (j = 0; j < n; ++j) {
-            for (k = 0; k < 4; ++k) {
-                l = inter_link->link[k][j];
-                if (l < .0) 
+        for (l0 = 0, j = 0; l0 < inter_link->b0; ++l0) {
+            for (l1 = 0; l1 < MIN(inter_link->b1, inter_link->r - l0); ++l1, ++j) {
+                a = inter_link_cell_area(link_mat, inter_link->c0, inter_link->c1, l0, l1);
+                if (a == .0)
                     continue;
-                ++hist[MIN(bin - 1, (int) l)];
+                for (k = 0; k < 4; ++k) {
+                    l = normalise_by_size(inter_link->link[k][j], a);
+                    ++hist[MIN(bin - 1, (int) l)];
+                }
             }
         }
     }
@@ -967,15 +2137,184 @@ int estimate_noise(inter_link_mat_t *link_mat)
     return n;
 }
 
-void inter_link_norms(inter_link_mat_t *link_mat, norm_t *norm, int use_estimated_noise, double *la)
+// adds MIN(1, MAX(0, c / a - noise) / norms[b + 1]) of the four orientations to fr[b * 4 + k] for the cells of row l0 starting at j
+typedef void (*inter_link_row_norm_f)(inter_link_mat_t *link_mat, inter_link_t *link, uint32_t l0, uint32_t j, const double *norms, double noise, double *fr, uint32_t *fn);
+
+static void inter_link_row_norm(inter_link_mat_t *link_mat, inter_link_t *link, uint32_t l0, uint32_t j, const double *norms, double noise, double *fr, uint32_t *fn)
+{
+    uint32_t k, b, l1;
+    double a, l;
+
+    for (l1 = 0; l1 < MIN(link->b1, link->r - l0); ++l1, ++j) {
+        b = l0 + l1;
+        if (norms[b + 1] > 0) {
+            a = inter_link_cell_area(link_mat, link->c0, link->c1, l0, l1);
+            if (a == .0)
+                continue;
+            for (k = 0; k < 4; ++k) {
+                l = normalise_by_size(link->link[k][j], a);
+                l = MAX(.0, l - noise);
+                fr[b * 4 + k] += MIN(1., l / norms[b + 1]);
+            }
+            ++fn[b];
+        }
+    }
+}
+
+#ifdef INTER_LINK_AVX2
+// the four orientations of a cell in one vector, with the same operations in the same order as the scalar kernel
+__attribute__((target("avx2")))
+static void inter_link_row_norm_avx2(inter_link_mat_t *link_mat, inter_link_t *link, uint32_t l0, uint32_t j, const double *norms, double noise, double *fr, uint32_t *fn)
+{
+    uint32_t b, l1;
+    double a;
+    __m128i c, sign;
+    __m256d v, zero, one, nv, off;
+
+    sign = _mm_set1_epi32(INT32_MIN);
+    off = _mm256_set1_pd(2147483648.);
+    zero = _mm256_setzero_pd();
+    one = _mm256_set1_pd(1.);
+    nv = _mm256_set1_pd(noise);
+    for (l1 = 0; l1 < MIN(link->b1, link->r - l0); ++l1, ++j) {
+        b = l0 + l1;
+        if (norms[b + 1] > 0) {
+            a = inter_link_cell_area(link_mat, link->c0, link->c1, l0, l1);
+            if (a == .0)
+                continue;
+            // counts are unsigned, converted exactly as signed with the sign bit flipped
+            c = _mm_set_epi32(link->link[3][j], link->link[2][j], link->link[1][j], link->link[0][j]);
+            v = _mm256_add_pd(_mm256_cvtepi32_pd(_mm_xor_si128(c, sign)), off);
+            v = _mm256_div_pd(v, _mm256_set1_pd(a));
+            v = _mm256_max_pd(zero, _mm256_sub_pd(v, nv));
+            v = _mm256_min_pd(one, _mm256_div_pd(v, _mm256_set1_pd(norms[b + 1])));
+            _mm256_storeu_pd(fr + b * 4, _mm256_add_pd(_mm256_loadu_pd(fr + b * 4), v));
+            ++fn[b];
+        }
+    }
+}
+#endif
+
+static int inter_link_simd = 1;
+
+// use the SIMD kernel in inter_link_norms if simd is set and the CPU supports it, return 1 if it will be used
+int inter_link_norms_simd(int simd)
+{
+    inter_link_simd = simd;
+#ifdef INTER_LINK_AVX2
+    return simd && __builtin_cpu_supports("avx2");
+#else
+    return 0;
+#endif
+}
+
+static inter_link_row_norm_f inter_link_row_norm_kernel(void)
+{
+#ifdef INTER_LINK_AVX2
+    if (inter_link_simd && __builtin_cpu_supports("avx2"))
+        return inter_link_row_norm_avx2;
+#endif
+    return inter_link_row_norm;
+}
+
+typedef struct {
+    inter_link_mat_t *link_mat;
+    const double *norms;
+    double noise;
+    double *t; // maximum norm of each pair before averaging
+    double **fr; // scratch of each thread
+    uint32_t **fn;
+    inter_link_row_norm_f row_norm;
+} pair_norm_t;
+
+// norms of pair i
+static void inter_link_pair_norm(void *data, long i, int tid)
 {
-    uint32_t i, j, k, b, b1, r, n, n0;
+    pair_norm_t *d = (pair_norm_t *) data;
+    uint32_t j, k, b, r, n0, l0;
     uint32_t *fn;
-    int8_t bl;
-    double l, *norms, *fr, noise;
-    double c, c0, t;
+    double *fr, t;
     inter_link_t *inter_link;
 
+    d->t[i] = .0;
+    inter_link = &d->link_mat->links[i];
+    if (inter_link->n == 0)
+        return;
+    r = inter_link->r;
+
+    fr = d->fr[tid];
+    fn = d->fn[tid];
+    memset(fr, 0, 4 * r * sizeof(double));
+    memset(fn, 0, r * sizeof(uint32_t));
+
+    for (l0 = 0, j = 0; l0 < inter_link->b0; j += MIN(inter_link->b1, r - l0), ++l0)
+        d->row_norm(d->link_mat, inter_link, l0, j, d->norms, d->noise, fr, fn);
+    if (fn[0] == 0)
+        return;
+
+    // cumsum
+    for (k = 0; k < 4; ++k)
+        inter_link->norms[k] = fr[k];
+    for (b = 1; b < r; ++b) {
+        for (k = 0; k < 4; ++k) {
+            inter_link->norms[k] += fr[b * 4 + k] * fr[(b - 1) * 4 + k] / fn[b - 1];
+            fr[b * 4 + k] += fr[(b - 1) * 4 + k];
+        }
+        fn[b] += fn[b - 1];
+    }
+
+    n0 = fn[r - 1];
+    t = 0;
+    for (k = 0; k < 4; ++k) {
+        if (inter_link->norms[k] > t)
+            t = inter_link->norms[k];
+        inter_link->norms[k] /= n0;
+    }
+    inter_link->n0 = n0;
+    d->t[i] = t;
+}
+
+// add the norms of each pair of link_mat, return c0 plus the maximum norm of each pair before averaging
+// pairs are scored in parallel and summed in their order, so c0 does not depend on the number of threads
+static double inter_link_norms_add(inter_link_mat_t *link_mat, const double *norms, double noise, double c0, int n_threads)
+{
+    int i;
+    uint32_t j;
+    pair_norm_t data;
+
+    data.link_mat = link_mat;
+    data.norms = norms;
+    data.noise = noise;
+    data.row_norm = inter_link_row_norm_kernel();
+    data.t = (double *) malloc(link_mat->n * sizeof(double));
+    data.fr = (double **) malloc(n_threads * sizeof(double *));
+    data.fn = (uint32_t **) malloc(n_threads * sizeof(uint32_t *));
+    for (i = 0; i < n_threads; ++i) {
+        data.fr[i] = (double *) malloc(4 * link_mat->r * sizeof(double));
+        data.fn[i] = (uint32_t *) malloc(link_mat->r * sizeof(uint32_t));
+    }
+    kt_for(n_threads, inter_link_pair_norm, &data, link_mat->n);
+    for (j = 0; j < link_mat->n; ++j)
+        c0 += data.t[j];
+
+    for (i = 0; i < n_threads; ++i) {
+        free(data.fr[i]);
+        free(data.fn[i]);
+    }
+    free(data.fr);
+    free(data.fn);
+    free(data.t);
+
+    return c0;
+}
+
+void inter_link_norms(inter_link_mat_t *link_mat, norm_t *norm, int use_estimated_noise, double *la, int n_threads)
+{
+    uint32_t i, r;
+    uint64_t cn, pa;
+    double *norms, noise;
+    double c, c0;
+
     noise = .0;
     if (use_estimated_noise) {
         // noise = estimate_noise(link_mat);
@@ -1026,95 +2365,124 @@ void inter_link_norms(inter_link_mat_t *link_mat, norm_t *norm, int use_estimate
     }
     **/
     
-    c = c0 = 0;
-    for (i = 0; i < link_mat->n; ++i) {
-        inter_link = &link_mat->links[i];
-        n = inter_link->n;
-        if (n == 0)
-            continue;
-        r = inter_link->r;
-        b1 = inter_link->b1;
+    // cells with an area, including those of pairs without links
+    inter_link_mat_area(link_mat, norms, &pa, &cn);
+    c0 = inter_link_norms_add(link_mat, norms, noise, .0, n_threads);
+    c = cn;
+    *la = c0 / c;
+    fprintf(stderr, "[I::%s] average link count: %.12f %.12f %.12f\n", __func__, c0, c, *la);
+    
+    free(norms);
+}
 
-        fr = (double *) calloc(4 * r, sizeof(double));
-        fn = (uint32_t *) calloc(r, sizeof(uint32_t));
+// inter links of the pairs estimated tile by tile within max_mem, as inter_link_norms and calc_link_directs do for the whole matrix
+// links are read from buf if given, otherwise from the file or contact cache twice per tile but the first one
+// only the norms, linkt and n0 of the pairs are kept
+inter_link_mat_t *inter_link_mat_from_tiles(const char *f, contact_cache_t *cc, inter_link_buf_t *buf, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, norm_t *norm, double min_norm, uint8_t mq, long max_mem, int n_threads, double *la)
+{
+    int i, n_tile;
+    uint32_t j, k, r, *s;
+    uint64_t cn, pa;
+    long noise_c;
+    double *norms, noise, c0;
+    inter_link_mat_t *link_mat, *tile;
+    inter_link_t *link;
 
-        for (j = 0; j < n; ++j) {
-            b = j / b1 + j % b1;
-            if (b < r) {
-                if (norms[b + 1] > 0) {
-                    bl = 0;
-                    for (k = 0; k < 4; ++k) {
-                        l = inter_link->link[k][j];
-                        if(l < .0)
-                            break;
-                        l = MAX(.0, l - noise);
-                        fr[k * r + b] += MIN(1., l / norms[b + 1]);
-                        bl = 1;
-                    }
-                    if (bl)
-                        ++fn[b];
-                }
-            }
+    link_mat = inter_link_mat_init(dict, re_cuts, resolution, norm->r);
+    kh_destroy(pair, (khash_t(pair) *) link_mat->h);
+    link_mat->h = 0;
+    s = inter_link_mat_tiles(link_mat, max_mem, &n_tile);
+    fprintf(stderr, "[I::%s] inter link matrix split into %d tiles\n", __func__, n_tile);
+
+    // noise links of all tiles, the first tile is built last and kept for the norms
+    noise_c = 0;
+    tile = 0;
+    for (i = n_tile - 1; i >= 0; --i) {
+        tile = inter_link_mat_tile_init(link_mat, s[i], s[i + 1]);
+        inter_link_mat_tile_fill(tile, f, cc, buf, dict, resolution, mq, n_threads);
+        noise_c += inter_link_mat_noise_links(tile);
+        if (i > 0)
+            inter_link_mat_tile_destroy(tile);
+    }
+    inter_link_mat_set_noise(link_mat, noise_c);
+
+    noise = link_mat->noise;
+    fprintf(stderr, "[I::%s] using noise level %.12f\n", __func__, noise);
+    r = link_mat->r;
+    norms = (double *) malloc((r + 1) * sizeof(double));
+    for (j = 0; j <= r; ++j)
+        norms[j] = norm->norms[j] - noise;
+    inter_link_mat_area(link_mat, norms, &pa, &cn);
+
+    // tiles are scored in the order of their pairs, so the sums are the same as for the whole matrix
+    c0 = .0;
+    for (i = 0; i < n_tile; ++i) {
+        if (i > 0) {
+            tile = inter_link_mat_tile_init(link_mat, s[i], s[i + 1]);
+            inter_link_mat_tile_fill(tile, f, cc, buf, dict, resolution, mq, n_threads);
+            // only to fill linkb, the noise level is already known
+            inter_link_mat_noise_links(tile);
         }
-        if (fn[0] == 0)
-            goto loop_i_end;
+        c0 = inter_link_norms_add(tile, norms, noise, c0, n_threads);
+        calc_link_directs(tile, min_norm, dict, 0, n_threads);
 
-        // cumsum
-        for (k = 0; k < 4; ++k)
-            inter_link->norms[k] = fr[k * r];
-        for (b = 1; b < r; ++b) {
+        if (link_mat->n + tile->n > link_mat->m) {
+            while (link_mat->n + tile->n > link_mat->m)
+                link_mat->m = link_mat->m? link_mat->m << 1 : 16;
+            link_mat->links = (inter_link_t *) realloc(link_mat->links, (uint64_t) link_mat->m * sizeof(inter_link_t));
+        }
+        for (j = 0; j < tile->n; ++j) {
+            link = &tile->links[j];
+            free(link->link[0]);
             for (k = 0; k < 4; ++k) {
-                inter_link->norms[k] += fr[k * r + b] * fr[k * r + b - 1] / fn[b - 1];
-                fr[k * r + b] += fr[k * r + b - 1];
+                free(link->linkb[k]);
+                link->link[k] = 0;
+                link->linkb[k] = 0;
             }
-            fn[b] += fn[b - 1];
-        }
-
-        n0 = fn[r - 1];
-        t = 0;
-        for (k = 0; k < 4; ++k) {
-            if (inter_link->norms[k] > t)
-                t = inter_link->norms[k];
-            inter_link->norms[k] /= n0;
+            link_mat->links[link_mat->n++] = *link;
         }
-        inter_link->n0 = n0;
-        c += n0;
-        c0 += t;
-loop_i_end:
-        free(fr);
-        free(fn);
+        tile->n = 0;
+        inter_link_mat_tile_destroy(tile);
     }
-    
-    *la = c0 / c;
-    fprintf(stderr, "[I::%s] average link count: %.12f %.12f %.12f\n", __func__, c0, c, *la);
-    
+
+    *la = c0 / cn;
+    fprintf(stderr, "[I::%s] average link count: %.12f %.12f %.12f\n", __func__, c0, (double) cn, *la);
+
     free(norms);
+    free(s);
+
+    return link_mat;
 }
 
-int8_t *calc_link_directs_from_file(const char *f, asm_dict_t *dict)
+int8_t *calc_link_directs_from_file(const char *f, asm_dict_t *dict, uint8_t mq)
 {
     uint32_t i, j, n, na, k, b0, b1, b, ma, sma, n_ma;
-    uint32_t buffer[BUFF_SIZE], m, i0, i1;
+    const uint32_t *buffer;
+    uint32_t *sid;
+    uint64_t *spos;
+    uint32_t m, i0, i1;
     uint64_t p0, p1;
     uint32_t *link, l;
     int8_t *directs;
     long pair_c, inter_c;
-    FILE *fp;
+    bin_reader_t *fp;
 
-    fp = fopen(f, "r");
-    if (fp == NULL)
-        return 0;
+    fp = bin_reader_open(f, dict->sdict, mq);
 
     n = dict->n;
     na = (long) n * (n - 1) / 2;
     link = (uint32_t *) calloc(na << 2, sizeof(uint32_t));
     pair_c = inter_c = 0;
 
-    while (1) {
-        m = fread(&buffer, sizeof(uint32_t), BUFF_SIZE, fp);
+    sid = (uint32_t *) malloc(BIN_BLOCK_SIZE * 2 * sizeof(uint32_t));
+    spos = (uint64_t *) malloc(BIN_BLOCK_SIZE * 2 * sizeof(uint64_t));
+    while ((m = bin_read_pairs(fp, &buffer)) > 0) {
+        sd_coordinate_conversion_pairs(dict, buffer, m / 4, sid, spos, 0);
         for (i = 0; i < m; i += 4) {
-            sd_coordinate_conversion(dict, buffer[i], buffer[i + 1], &i0, &p0, 0);
-            sd_coordinate_conversion(dict, buffer[i + 2], buffer[i + 3], &i1, &p1, 0);
+            i0 = sid[i / 2];
+            p0 = spos[i / 2];
+            i1 = sid[i / 2 + 1];
+            p1 = spos[i / 2 + 1];
 
             if (i0 != i1) {
                 ++inter_c;
@@ -1130,17 +2498,14 @@ int8_t *calc_link_directs_from_file(const char *f, asm_dict_t *dict)
             }
         }
         pair_c += m / 4;
-        if (m < BUFF_SIZE) {
-            if (ferror(fp))
-                return 0;
-            break;
-        }
     }
 
 #ifdef DEBUG
     printf("[I::%s] %ld read pairs processed, %ld inter links \n", __func__, pair_c, inter_c);
 #endif
-    fclose(fp);
+    bin_reader_close(fp);
+    free(sid);
+    free(spos);
     
     directs = (int8_t *) malloc(na * sizeof(int8_t));
     for (i = 0; i < na; ++i) {
@@ -1175,322 +2540,155 @@ int8_t *calc_link_directs_from_file(const char *f, asm_dict_t *dict)
     return directs;
 }
 
-void calc_link_directs(inter_link_mat_t *link_mat, double min_norm, asm_dict_t *dict, int8_t *directs)
+typedef struct {
+    inter_link_mat_t *link_mat;
+    double min_norm;
+    asm_dict_t *dict;
+} link_direct_t;
+
+// orientation of pair i
+static void calc_link_direct(void *data, long i, int tid)
 {
-    uint32_t i, j, k, n, b, b0, b1, r, n_ma;
+    link_direct_t *d = (link_direct_t *) data;
+    inter_link_mat_t *link_mat = d->link_mat;
+    uint32_t j, k, r, n_ma;
     int8_t t;
     inter_link_t *inter_link;
     double area[4]; // area under the cumsum of linkb
     double ma, sma;
-    uint32_t max_b = UINT32_MAX;
 
-    r = link_mat->r;
-    for (i = 0; i < link_mat->n; ++i) {
-        inter_link = &link_mat->links[i];
-        n = inter_link->n;
-        if (n == 0)
-            continue;
-        b0 = inter_link->b0;
-        b1 = inter_link->b1;
-        for (j = 0; j < n; ++j) {
-            b = j / b1 + j % b1;
-            if (b <= b0 && b <= b1 && b <= max_b && b < r)
-                for (k = 0; k < 4; ++k)
-                    if (inter_link->link[k][j] > .0)
-                        inter_link->linkb[k][b] += inter_link->link[k][j];
+    inter_link = &link_mat->links[i];
+    if (inter_link->n == 0)
+        return;
+    r = inter_link->r;
+    // linkb is filled along with the noise links
+    memset(area, 0, sizeof(area));
+    for (j = 0; j < r; ++j)
+        for (k = 0; k < 4; ++k)
+            area[k] += inter_link->linkb[k][j]; //* (r - j);
+    // select the one with maximum cumsum area as linkt
+    t = 0;
+    ma = sma = 0;
+    n_ma = 0;
+    for (k = 0; k < 4; ++k) {
+        if (area[k] > ma) {
+            sma = ma;
+            ma = area[k];
+            n_ma = 1;
+            t = k;
+        } else if (area[k] == ma) {
+            ++n_ma;
+        } else if (area[k] > sma) {
+            sma = area[k];
         }
     }
-
-    for (i = 0; i < link_mat->n; ++i) {
-        inter_link = &link_mat->links[i];
-        if (inter_link->n == 0)
-            continue;
-        r = inter_link->r;
-        memset(area, 0, sizeof(area));
-        for (j = 0; j < r; ++j)
-            for (k = 0; k < 4; ++k)
-                area[k] += inter_link->linkb[k][j]; //* (r - j);
-        // select the one with maximum cumsum area as linkt
+    if (n_ma == 1 && ma * .9 > sma) {
+        inter_link->linkt = 1 << t;
+    } else {
         t = 0;
-        ma = sma = 0;
-        n_ma = 0;
-        for (k = 0; k < 4; ++k) {
-            if (area[k] > ma) {
-                sma = ma;
-                ma = area[k];
-                n_ma = 1;
-                t = k;
-            } else if (area[k] == ma) {
-                ++n_ma;
-            } else if (area[k] > sma) {
-                sma = area[k];
-            }
-        }
-        if (n_ma == 1 && ma * .9 > sma) {
-            inter_link->linkt = 1 << t;
-        } else {
-            t = 0;
-            for (k = 0; k < 4; ++k)
-                if (inter_link->norms[k] >= min_norm)
-                    t |= (1 << k);
-            inter_link->linkt = t;
-        }
+        for (k = 0; k < 4; ++k)
+            if (inter_link->norms[k] >= d->min_norm)
+                t |= (1 << k);
+        inter_link->linkt = t;
+    }
 
 #ifdef DEBUG_ORIEN
-        printf("[I::%s] %d %.0f %.0f %d %d [%.3f %.3f %.3f %.3f] [%.0f  %.0f  %.0f  %.0f] %s %s\n", __func__, inter_link->linkt, ma, sma, inter_link->b0, inter_link->b1, inter_link->norms[0], inter_link->norms[1], inter_link->norms[2], inter_link->norms[3], area[0], area[1], area[2], area[3], dict->s[inter_link->c0].name, dict->s[inter_link->c1].name);
+    asm_dict_t *dict = d->dict;
+    printf("[I::%s] %d %.0f %.0f %d %d [%.3f %.3f %.3f %.3f] [%.0f  %.0f  %.0f  %.0f] %s %s\n", __func__, inter_link->linkt, ma, sma, inter_link->b0, inter_link->b1, inter_link->norms[0], inter_link->norms[1], inter_link->norms[2], inter_link->norms[3], area[0], area[1], area[2], area[3], dict->s[inter_link->c0].name, dict->s[inter_link->c1].name);
 #endif
-    }
 }
 
-static int32_t get_target_end(uint32_t *cigar, int n_cigar, int32_t s)
+void calc_link_directs(inter_link_mat_t *link_mat, double min_norm, asm_dict_t *dict, int8_t *directs, int n_threads)
 {
-    int i;
-    uint8_t c;
-    for (i = 0; i < n_cigar; ++i) {
-        c = cigar[i] & BAM_CIGAR_MASK;
-        if (c == BAM_CMATCH || c == BAM_CDEL)
-            s += cigar[i] >> BAM_CIGAR_SHIFT;
-    }
-    return s;
+    link_direct_t data;
+
+    data.link_mat = link_mat;
+    data.min_norm = min_norm;
+    data.dict = dict;
+    kt_for(n_threads, calc_link_direct, &data, link_mat->n);
 }
 
-static char *parse_bam_rec(bam1_t *b, bam_header_t *h, uint8_t q, int32_t *s, int32_t *e, char **cname)
+// BIN writer of the dumpers, keeping the mapping qualities so that the file can be reused with any -q
+// records are stored in compressed blocks if asked, and always in a sorted file
+// max_mem: memory for sorting before spilling sorted runs next to the output file
+static bin_writer_t *bin_writer_open_for_dump(const char *out, sdict_t *dict, int sort, int block, long max_mem)
 {
-    // 0x4 0x100 0x400 0x800
-    if (b->core.flag & 0xD04)
-        return 0;
-    *cname = h->target_name[b->core.tid];
-    if (b->core.qual < q) {
-        *s = -1;
-        *e = -1;
-    } else {
-        *s = b->core.pos + 1;
-        *e = get_target_end(bam1_cigar(b), b->core.n_cigar, b->core.pos) + 1;
-    }
-    
-    return strdup(bam1_qname(b));
+    return bin_writer_open(out, dict, 0, BIN_FLAG_QUAL | (block || sort? BIN_FLAG_BLOCK : 0) | (sort? BIN_FLAG_SORTED : 0), max_mem);
 }
 
-void dump_links_from_bam_file(const char *f, const char *fai, uint32_t ml, uint8_t mq, const char *out)
+void dump_links_from_bam_file(const char *f, const char *fai, const char *out, int n_threads, long max_mem, int sort, int block)
 {
-    bamFile fp;
-    FILE *fo;
-    bam_header_t *h;
-    bam1_t *b;
-    char *cname0, *cname1, *rname0, *rname1;
-    int32_t s0, s1, e0, e1;
-    uint32_t i0, i1, p0, p1;
-    int8_t buff;
-    long rec_c, pair_c, inter_c, intra_c;
-    
-    khash_t(str) *hmseq; // for absent sequences
-    khint_t k;
-    int absent;
-    hmseq = kh_init(str);
+    bin_writer_t *fo;
+    bam_pair_reader_t *r;
+    hic_pair_t pair;
+    long pair_c, inter_c, intra_c;
 
-    sdict_t *dict = make_sdict_from_index(fai, ml);
+    // all sequences are kept in the BIN file so that it can be reused with any length threshold
+    sdict_t *dict = make_sdict_from_index(fai, 0);
 
-    fp = bam_open(f, "r"); // sorted by read name
-    if (fp == NULL) {
-        fprintf(stderr, "[E::%s] cannot open fail %s for reading\n", __func__, f);
-        exit(EXIT_FAILURE);
-    }
+    r = bam_pair_reader_open(f, dict, 0, n_threads, max_mem, out);
     
-    fo = fopen(out, "w");
-    if (fo == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for writing\n", __func__, out);
-        exit(EXIT_FAILURE);
-    }
-
-    h = bam_header_read(fp);
-    b = bam_init1();
-    cname0 = cname1 = rname0 = rname1 = 0;
-    s0 = s1 = e0 = e1 = 0;
-    i0 = i1 = p0 = p1 = 0;
-    rec_c = pair_c = inter_c = intra_c = 0;
-    buff = 0;
-    while (bam_read1(fp, b) >= 0 ) {
-        if (buff == 0) {
-            rname0 = parse_bam_rec(b, h, mq, &s0, &e0, &cname0);
-            if (!rname0)
-                continue;
-            ++buff;
-        } else if (buff == 1) {
-            rname1 = parse_bam_rec(b, h, mq, &s1, &e1, &cname1);
-            if (!rname1)
-                continue;
-            if (strcmp(rname0, rname1) == 0) {
-                ++pair_c;
-
-                if (s0 > 0 && s1 > 0) {
-                    i0 = sd_get(dict, cname0);
-                    i1 = sd_get(dict, cname1);
-
-                    if (i0 == UINT32_MAX) {
-                        k = kh_put(str, hmseq, cname0, &absent);
-                        if (absent) {
-	                        kh_key(hmseq, k) = strdup(cname0);
-	                        fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname0);
-                        }
-                    } else if (i1 == UINT32_MAX) {
-                        k = kh_put(str, hmseq, cname1, &absent);
-                        if (absent) {
-	                        kh_key(hmseq, k) = strdup(cname1);
-	                        fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname1);
-                        }
-                    } else {
-                        if (i0 == i1)
-                            ++intra_c;
-                        else
-                            ++inter_c;
-                        p0 = s0 / 2 + e0 / 2 + (s0 & 1 && e0 & 1);
-                        p1 = s1 / 2 + e1 / 2 + (s1 & 1 && e1 & 1);
-                        if (i0 > i1) {
-                            SWAP(uint32_t, i0, i1);
-                            SWAP(uint32_t, p0, p1);
-                        }
-                        fwrite(&i0, sizeof(uint32_t), 1, fo);
-                        fwrite(&p0, sizeof(uint32_t), 1, fo);
-                        fwrite(&i1, sizeof(uint32_t), 1, fo);
-                        fwrite(&p1, sizeof(uint32_t), 1, fo);
-                    }
-                }
-                free(rname0);
-                free(rname1);
-                rname0 = 0;
-                rname1 = 0;
-                buff = 0;
-            } else {
-                cname0 = cname1;
-                s0 = s1;
-                e0 = e1;
-                free(rname0);
-                rname0 = rname1;
-                rname1 = 0;
-                buff = 1;
-            }
-        }
+    fo = bin_writer_open_for_dump(out, dict, sort, block, max_mem);
 
-        if (++rec_c % 1000000 == 0)
-            fprintf(stderr, "[I::%s] %ld million records processed, %ld read pairs \n", __func__, rec_c / 1000000, pair_c);
+    inter_c = intra_c = 0;
+    while (bam_pair_read(r, &pair)) {
+        if (pair.c0 == UINT32_MAX || pair.c1 == UINT32_MAX)
+            continue;
+        if (pair.c0 == pair.c1)
+            ++intra_c;
+        else
+            ++inter_c;
+        bin_write_pair(fo, pair.c0, pair.p0, pair.c1, pair.p1, pair.q0, pair.q1, pair.dup);
     }
+    pair_c = r->pair_c;
 
-    for (k = 0; k < kh_end(hmseq); ++k)
-	if (kh_exist(hmseq, k))
-		free((char *) kh_key(hmseq, k));
-    kh_destroy(str, hmseq);
-
-    if (rname0)
-        free(rname0);
-    if (rname1)
-        free(rname1);
-    bam_destroy1(b);
-    bam_header_destroy(h);
+    bam_pair_reader_close(r);
+    bin_writer_close(fo);
     sd_destroy(dict);
-    bam_close(fp);
-    fclose(fo);
 
     fprintf(stderr, "[I::%s] dumped %ld read pairs: %ld intra links + %ld inter links \n", __func__, pair_c, intra_c, inter_c);
 }
 
-void dump_links_from_bed_file(const char *f, const char *fai, uint32_t ml, uint8_t mq, const char *out)
+static void dump_links_from_txt_file(const char *f, const char *fai, const char *out, int fmt, int n_threads, long max_mem, int sort, int block)
 {
-    FILE *fp, *fo;
-    char *line = NULL;
-    size_t ln = 0;
-    ssize_t read;
-    char cname0[4096], cname1[4096], rname0[4096], rname1[4096];
-    uint32_t s0, s1, e0, e1, i0, i1, p0, p1;
-    int8_t buff;
-    long rec_c, pair_c, inter_c, intra_c;
+    bin_writer_t *fo;
+    txt_pair_reader_t *r;
+    hic_pair_t pair;
+    long pair_c, inter_c, intra_c;
 
-    khash_t(str) *hmseq; // for absent sequences
-    khint_t k;
-    int absent;
-    hmseq = kh_init(str);
+    // all sequences are kept in the BIN file so that it can be reused with any length threshold
+    sdict_t *dict = make_sdict_from_index(fai, 0);
 
-    sdict_t *dict = make_sdict_from_index(fai, ml);
+    r = txt_pair_reader_open(f, dict, fmt, n_threads);
 
-    fp = fopen(f, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
-        exit(EXIT_FAILURE);
-    }
-    fo = fopen(out, "w");
-    if (fo == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for writing\n", __func__, out);
-        exit(EXIT_FAILURE);
-    }
-    
-    s0 = s1 = e0 = e1 = 0;
-    i0 = i1 = p0 = p1 = 0;
-    rec_c = pair_c = inter_c = intra_c = 0;
-    buff = 0;
-    while ((read = getline(&line, &ln, fp)) != -1) {
-        if (buff == 0) {
-            sscanf(line, "%s %u %u %s", cname0, &s0, &e0, rname0);
-            ++buff;
-        } else if (buff == 1) {
-            sscanf(line, "%s %u %u %s", cname1, &s1, &e1, rname1);
-            if (is_read_pair(rname0, rname1)) {
-                ++pair_c;
-
-                i0 = sd_get(dict, cname0);
-                i1 = sd_get(dict, cname1);
-
-                if (i0 == UINT32_MAX) {
-                    k = kh_put(str, hmseq, cname0, &absent);
-                    if (absent) {
-	                    kh_key(hmseq, k) = strdup(cname0);
-	                    fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname0);
-                    }
-                } else if (i1 == UINT32_MAX) {
-                    k = kh_put(str, hmseq, cname1, &absent);
-                    if (absent) {
-	                    kh_key(hmseq, k) = strdup(cname1);
-	                    fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname1);
-                    }
-                } else {
-                    if (i0 == i1)
-                        ++intra_c;
-                    else
-                        ++inter_c;
-                    p0 = s0 / 2 + e0 / 2 + (s0 & 1 && e0 & 1);
-                    p1 = s1 / 2 + e1 / 2 + (s1 & 1 && e1 & 1);
-                    if (i0 > i1) {
-                        SWAP(uint32_t, i0, i1);
-                        SWAP(uint32_t, p0, p1);
-                    }
-                    fwrite(&i0, sizeof(uint32_t), 1, fo);
-                    fwrite(&p0, sizeof(uint32_t), 1, fo);
-                    fwrite(&i1, sizeof(uint32_t), 1, fo);
-                    fwrite(&p1, sizeof(uint32_t), 1, fo);
-                }
-                buff = 0;
-            } else {
-                strcpy(cname0, cname1);
-                s0 = s1;
-                e0 = e1;
-                strcpy(rname0, rname1);
-                buff = 1;
-            }
-        }
+    fo = bin_writer_open_for_dump(out, dict, sort, block, max_mem);
 
-        if (++rec_c % 1000000 == 0)
-            fprintf(stderr, "[I::%s] %ld million records processed, %ld read pairs \n", __func__, rec_c / 1000000, pair_c);
+    inter_c = intra_c = 0;
+    while (txt_pair_read(r, &pair)) {
+        if (pair.c0 == UINT32_MAX || pair.c1 == UINT32_MAX)
+            continue;
+        if (pair.c0 == pair.c1)
+            ++intra_c;
+        else
+            ++inter_c;
+        bin_write_pair(fo, pair.c0, pair.p0, pair.c1, pair.p1, pair.q0, pair.q1, pair.dup);
     }
+    pair_c = r->pair_c;
 
-    for (k = 0; k < kh_end(hmseq); ++k)
-	if (kh_exist(hmseq, k))
-		free((char *) kh_key(hmseq, k));
-    kh_destroy(str, hmseq);
-
-    if (line)
-        free(line);
+    txt_pair_reader_close(r);
+    bin_writer_close(fo);
     sd_destroy(dict);
-    fclose(fp);
-    fclose(fo);
 
     fprintf(stderr, "[I::%s] dumped %ld read pairs: %ld intra links + %ld inter links \n", __func__, pair_c, intra_c, inter_c);
 }
 
+void dump_links_from_bed_file(const char *f, const char *fai, const char *out, int n_threads, long max_mem, int sort, int block)
+{
+    dump_links_from_txt_file(f, fai, out, PAIR_FMT_BED, n_threads, max_mem, sort, block);
+}
+
+void dump_links_from_pairs_file(const char *f, const char *fai, const char *out, int n_threads, long max_mem, int sort, int block)
+{
+    dump_links_from_txt_file(f, fai, out, PAIR_FMT_PAIRS, n_threads, max_mem, sort, block);
+}
+
@@ -35,27 +35,31 @@
 
 #include "sdict.h"
 #include "enzyme.h"
+#include "contact.h"
 
 #define SQRT2 1.41421356237
 #define SQRT2_2 .70710678118
 
+// cells hold link counts, normalised by the cell area scaled by the restriction site density when used
 typedef struct {
     uint32_t c;
     uint32_t n;
-    double *link;
+    double a; // relative size of the last cell
+    uint32_t *link; // link counts of the first MIN(n, MAX_BAND) bands, band by band
+    double *d; // normalised link counts of each band from MAX_BAND on, NULL if none [1 x n - 1 - MAX_BAND]
 } intra_link_t;
 
 typedef struct {
     uint32_t c0, c1; // sequence id
     uint32_t b0, b1; // number of bands
     uint32_t r; // real radius MIN(R, b0 + b1 - 1)
-    uint32_t n, n0; // number of cells, n = b0 * b1, n0 is the real number of cells
+    uint32_t n, n0; // number of cells (i, j) with i + j < r, n0 is the real number of cells
     int8_t linkt; // 0...3 determine the join direction
     // link[0]: i0(-) -> i1(+)
     // link[1]: i0(-) -> i1(-)
     // link[2]: i0(+) -> i1(+)
     // link[3]: i0(+) -> i1(-)
-    double *link[4]; // size 4 x n
+    uint32_t *link[4]; // link counts, size 4 x n in one block
     double *linkb[4]; // total number of links in each band, of size 4 x r
     double norms[4];
 } inter_link_t;
@@ -63,15 +67,46 @@ typedef struct {
 typedef struct {
     uint32_t n;
     intra_link_t *links;
+    double **re_dens; // restriction site density of each cell, NULL if not used
 } intra_link_mat_t;
 
 typedef struct {
-    uint32_t n;
+    uint32_t n, m; // number of sequence pairs with links and allocated size
     uint32_t r; // radius
     double noise; // noise
-    inter_link_t *links;
+    inter_link_t *links; // sequence pairs with links, sorted by (c0, c1) once the matrix is complete
+    void *h; // (c0, c1) -> index in links, only kept while the matrix is filled
+    // pairs without links are not stored, their cells are counted from the bands of each sequence
+    uint32_t n_seq;
+    uint32_t s0, s1; // only pairs with s0 <= c0 < s1 are stored
+    uint32_t *bn; // number of bands of each sequence, 0 if shorter than twice the resolution
+    double *ba; // relative size of the last band of each sequence
+    double **re_dens; // restriction site density of each band, NULL if not used
 } inter_link_mat_t;
 
+typedef struct {
+    uint64_t n, m; // number of records and allocated size
+    uint64_t max; // maximum records allowed
+    uint32_t *a; // encoded inter-scaffold links [4 x n], NULL if buffering is disabled or given up
+} inter_link_buf_t;
+
+#define INTER_ACC_WINDOW (1 << 20) // records held before they are partitioned and added
+#define INTER_ACC_BKT_SIZE (1 << 20) // bytes of the inter link matrix per bucket if all pairs were linked
+#define INTER_ACC_MAX_BKT 4096
+
+typedef struct {
+    inter_link_mat_t *link_mat;
+    uint32_t radius;
+    int n_bkt, shift; // bucket of a record: first sequence id >> shift
+    int n_threads;
+    uint32_t n, m; // number of records held and the window size
+    uint32_t *a, *b; // records [5 x m] as pushed and partitioned by bucket
+    uint32_t *off; // bucket offsets [n_bkt + 1]
+    uint32_t **cell; // cell of each partitioned record with multiple threads [m]
+    long *bkt_c; // number of links added by each bucket with multiple threads [n_bkt]
+    long radius_c; // number of links added
+} inter_link_acc_t;
+
 typedef struct {
     uint32_t n; // number of bands
     uint32_t *bs; // number of cells in each band [1 x n]
@@ -88,12 +123,21 @@ extern "C" {
 intra_link_mat_t *intra_link_mat_init(asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution);
 intra_link_mat_t *intra_link_mat_init_sdict(sdict_t *dict, re_cuts_t *re_cuts, uint32_t resolution);
 inter_link_mat_t *inter_link_mat_init(asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius);
-intra_link_mat_t *intra_link_mat_from_file(const char *f, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, int use_gap_seq);
-inter_link_mat_t *inter_link_mat_from_file(const char *f, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius);
+intra_link_mat_t *intra_link_mat_from_file(const char *f, contact_cache_t *cc, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, int use_gap_seq, uint8_t mq, inter_link_buf_t *inter, int n_threads);
+inter_link_mat_t *inter_link_mat_from_file(const char *f, contact_cache_t *cc, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius, uint8_t mq, int n_threads);
+inter_link_mat_t *inter_link_mat_from_buf(inter_link_buf_t *buf, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius, int n_threads);
+inter_link_mat_t *inter_link_mat_from_tiles(const char *f, contact_cache_t *cc, inter_link_buf_t *buf, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, norm_t *norm, double min_norm, uint8_t mq, long max_mem, int n_threads, double *la);
+inter_link_acc_t *inter_link_acc_init(inter_link_mat_t *link_mat, uint32_t radius, int n_bkt, int n_threads);
+void inter_link_acc_push(inter_link_acc_t *acc, const uint32_t *r);
+void inter_link_acc_flush(inter_link_acc_t *acc);
+void inter_link_acc_destroy(inter_link_acc_t *acc);
+inter_link_buf_t *inter_link_buf_init(long max_mem);
+void inter_link_buf_destroy(inter_link_buf_t *buf);
 intra_link_t *get_intra_link(intra_link_mat_t *link_mat, uint32_t i, uint32_t j);
 inter_link_t *get_inter_link(inter_link_mat_t *link_mat, uint32_t i, uint32_t j);
-norm_t *calc_norms(intra_link_mat_t *link_mat);
-void inter_link_norms(inter_link_mat_t *link_mat, norm_t *norm, int use_estimated_noise, double *la);
+norm_t *calc_norms(intra_link_mat_t *link_mat, int n_threads);
+void inter_link_norms(inter_link_mat_t *link_mat, norm_t *norm, int use_estimated_noise, double *la, int n_threads);
+int inter_link_norms_simd(int simd);
 void inter_link_weighted_norms(inter_link_mat_t *link_mat, norm_t *norm);
 void print_norms(FILE *fp, norm_t *norm);
 void print_intra_links(FILE *fp, intra_link_mat_t *link_mat, sdict_t *dict);
@@ -104,11 +148,12 @@ void intra_link_mat_destroy(intra_link_mat_t *link_mat);
 void inter_link_mat_destroy(inter_link_mat_t *link_mat);
 void norm_destroy(norm_t *norm);
 double *get_max_inter_norms(inter_link_mat_t *link_mat, asm_dict_t *dict);
-int8_t *calc_link_directs_from_file(const char *f, asm_dict_t *dict);
-void calc_link_directs(inter_link_mat_t *link_mat, double min_norm, asm_dict_t *dict, int8_t *directs);
-void dump_links_from_bam_file(const char *f, const char *fai, uint32_t ml, uint8_t mq, const char *out);
-void dump_links_from_bed_file(const char *f, const char *fai, uint32_t ml, uint8_t mq, const char *out);
-long estimate_inter_link_mat_init_rss(asm_dict_t *dict, uint32_t resolution, uint32_t radius);
+int8_t *calc_link_directs_from_file(const char *f, asm_dict_t *dict, uint8_t mq);
+void calc_link_directs(inter_link_mat_t *link_mat, double min_norm, asm_dict_t *dict, int8_t *directs, int n_threads);
+void dump_links_from_bam_file(const char *f, const char *fai, const char *out, int n_threads, long max_mem, int sort, int block);
+void dump_links_from_bed_file(const char *f, const char *fai, const char *out, int n_threads, long max_mem, int sort, int block);
+void dump_links_from_pairs_file(const char *f, const char *fai, const char *out, int n_threads, long max_mem, int sort, int block);
+long estimate_inter_link_mat_init_rss(asm_dict_t *dict, uint32_t resolution, uint32_t radius, uint64_t n_pair);
 long estimate_intra_link_mat_init_rss(asm_dict_t *dict, uint32_t resolution);
 long estimate_intra_link_mat_init_sdict_rss(sdict_t *dict, uint32_t resolution);
 #ifdef __cplusplus
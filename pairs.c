@@ -0,0 +1,825 @@
+/*********************************************************************************
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2021 Chenxi Zhou <chnx.zhou@gmail.com>                          *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in    *
+ * all copies or substantial portions of the Software.                           *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *********************************************************************************/
+
+/********************************** Revision History *****************************
+ *                                                                               *
+ * 18/10/26 - agent: Created                                                     *
+ *                                                                               *
+ *********************************************************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "khash.h"
+#include "ksort.h"
+#include "kthread.h"
+#include "asset.h"
+#include "pairs.h"
+
+typedef struct {
+    bam_mate_t m;
+    char qname[]; // read name
+} mate_rec_t;
+
+struct mate_run_s {
+    FILE *fp;
+    int i; // run index, mates with the same read name are taken in file order
+    bam_mate_t m; // current mate
+    char qname[256];
+};
+
+// approximate memory of a mate record, including malloc overhead
+#define MATE_REC_SIZE(l_qname) ((sizeof(mate_rec_t) + (l_qname) + 1 + 23) & ~15UL)
+
+KHASH_MAP_INIT_STR(mate, mate_rec_t *)
+
+#define mate_rec_lt(a, b) (strcmp((a)->qname, (b)->qname) < 0)
+typedef mate_rec_t *mate_rec_p;
+KSORT_INIT(mate_rec, mate_rec_p, mate_rec_lt)
+
+static int32_t get_target_end(const uint8_t *d, int32_t s)
+{
+    uint32_t i, n_cigar, cigar;
+    uint8_t c;
+    n_cigar = bam_raw_n_cigar(d);
+    for (i = 0; i < n_cigar; ++i) {
+        cigar = bam_raw_cigar(d, i);
+        c = cigar & BAM_CIGAR_MASK;
+        if (c == BAM_CMATCH || c == BAM_CDEL)
+            s += cigar >> BAM_CIGAR_SHIFT;
+    }
+    return s;
+}
+
+static inline uint32_t mid_pos(int32_t s, int32_t e)
+{
+    return s / 2 + e / 2 + (s & 1 && e & 1);
+}
+
+static int is_coordinate_sorted(bam_header_t *h)
+{
+    char *p, *q;
+    if (h->l_text < 3 || strncmp(h->text, "@HD", 3))
+        return 0;
+    q = strchr(h->text, '\n');
+    p = strstr(h->text, "\tSO:");
+    if (p == NULL || (q && p > q))
+        return 0;
+    p += 4;
+    return strncmp(p, "coordinate", 10) == 0 && (p[10] == '\t' || p[10] == '\n' || p[10] == '\0');
+}
+
+static void free_mates(bam_pair_reader_t *r)
+{
+    khash_t(mate) *h;
+    khint_t k;
+    h = (khash_t(mate) *) r->mates;
+    for (k = kh_begin(h); k != kh_end(h); ++k)
+        if (kh_exist(h, k))
+            free(kh_val(h, k));
+}
+
+bam_pair_reader_t *bam_pair_reader_open(const char *f, sdict_t *dict, uint8_t mq, int n_threads, long max_mem, const char *tmp)
+{
+    bam_pair_reader_t *r;
+    int32_t i;
+
+    r = (bam_pair_reader_t *) calloc(1, sizeof(bam_pair_reader_t));
+    r->fp = bam_open_mt(f, "r", n_threads);
+    if (r->fp == NULL) {
+        fprintf(stderr, "[E::%s] cannot open fail %s for reading\n", __func__, f);
+        exit(EXIT_FAILURE);
+    }
+    r->h = bam_header_read(r->fp);
+    if (r->h == NULL) {
+        fprintf(stderr, "[E::%s] cannot read BAM header from file %s\n", __func__, f);
+        exit(EXIT_FAILURE);
+    }
+    r->dict = dict;
+    r->mq = mq;
+    // resolve target names once instead of hashing them for every read pair
+    r->tid2id = (uint32_t *) malloc(sizeof(uint32_t) * (r->h->n_targets + 1));
+    r->warned = (uint8_t *) calloc(r->h->n_targets + 1, sizeof(uint8_t));
+    for (i = 0; i < r->h->n_targets; ++i)
+        r->tid2id[i] = sd_get(dict, r->h->target_name[i]);
+
+    r->coord = is_coordinate_sorted(r->h);
+    if (r->coord) {
+        r->max_mem = max_mem;
+        r->mates = kh_init(mate);
+        r->tmp = tmp? strdup(tmp) : 0;
+        fprintf(stderr, "[I::%s] coordinate-sorted BAM file, join mates by read name\n", __func__);
+    }
+
+    return r;
+}
+
+void bam_pair_reader_close(bam_pair_reader_t *r)
+{
+    int i;
+    if (r->coord) {
+        for (i = 0; i < r->n_run; ++i) {
+            if (r->run[i]->fp)
+                fclose(r->run[i]->fp);
+            free(r->run[i]);
+        }
+        free(r->run);
+        free(r->heap);
+        free_mates(r);
+        kh_destroy(mate, (khash_t(mate) *) r->mates);
+        free(r->tmp);
+    }
+    free(r->tid2id);
+    free(r->warned);
+    bam_header_destroy(r->h);
+    bam_close(r->fp);
+    free(r);
+}
+
+static void make_pair(bam_pair_reader_t *r, hic_pair_t *p, const bam_mate_t *m0, const bam_mate_t *m1)
+{
+    int32_t tid;
+
+    ++r->pair_c;
+    p->c0 = r->tid2id[m0->tid];
+    p->c1 = r->tid2id[m1->tid];
+    p->p0 = m0->s > 0? mid_pos(m0->s, m0->e) : 0;
+    p->p1 = m1->s > 0? mid_pos(m1->s, m1->e) : 0;
+    p->q0 = m0->q;
+    p->q1 = m1->q;
+    p->dup = m0->dup | m1->dup;
+    if (m0->s > 0 && m1->s > 0 && (p->c0 == UINT32_MAX || p->c1 == UINT32_MAX)) {
+        tid = p->c0 == UINT32_MAX? m0->tid : m1->tid;
+        if (!r->warned[tid]) {
+            r->warned[tid] = 1;
+            fprintf(stderr, "[W::bam_pair_read] sequence \"%s\" not found \n", r->h->target_name[tid]);
+        }
+    }
+}
+
+// write the unpaired mates sorted by read name to a new run file
+static void spill_mates(bam_pair_reader_t *r)
+{
+    khash_t(mate) *h;
+    khint_t k;
+    mate_rec_t **a;
+    mate_run_t *run;
+    uint8_t l;
+    size_t i, n;
+    char *fn;
+
+    h = (khash_t(mate) *) r->mates;
+    n = kh_size(h);
+    if (n == 0)
+        return;
+    a = (mate_rec_t **) malloc(n * sizeof(mate_rec_t *));
+    for (k = kh_begin(h), i = 0; k != kh_end(h); ++k)
+        if (kh_exist(h, k))
+            a[i++] = kh_val(h, k);
+    ks_introsort_mate_rec(n, a);
+
+    run = (mate_run_t *) calloc(1, sizeof(mate_run_t));
+    run->i = r->n_run;
+    if (r->tmp) {
+        fn = (char *) malloc(strlen(r->tmp) + 32);
+        sprintf(fn, "%s.mates.%04d.tmp", r->tmp, r->n_run);
+        run->fp = fopen(fn, "w+");
+        if (run->fp)
+            remove(fn); // deleted on close
+        free(fn);
+    } else {
+        run->fp = tmpfile();
+    }
+    if (run->fp == NULL) {
+        fprintf(stderr, "[E::%s] cannot open temporary file for writing\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n; ++i) {
+        l = strlen(a[i]->qname);
+        fwrite(&l, sizeof(uint8_t), 1, run->fp);
+        fwrite(a[i]->qname, sizeof(char), l, run->fp);
+        fwrite(&a[i]->m, sizeof(bam_mate_t), 1, run->fp);
+    }
+    if (fflush(run->fp) || ferror(run->fp)) {
+        fprintf(stderr, "[E::%s] failed to write temporary file\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    rewind(run->fp);
+    free(a);
+
+    if (r->n_run == r->m_run) {
+        r->m_run = r->m_run? r->m_run << 1 : 16;
+        r->run = (mate_run_t **) realloc(r->run, r->m_run * sizeof(mate_run_t *));
+    }
+    r->run[r->n_run++] = run;
+
+#ifdef DEBUG
+    fprintf(stderr, "[DEBUG::%s] run %d: %lu unpaired mates\n", __func__, run->i, n);
+#endif
+
+    free_mates(r);
+    kh_clear(mate, h);
+    r->mem = 0;
+}
+
+// join the mate with its buffered partner, return 1 if a pair is made
+static int join_mate(bam_pair_reader_t *r, hic_pair_t *p, const bam_mate_t *m, const char *qname, int l_qname)
+{
+    khash_t(mate) *h;
+    khint_t k;
+    mate_rec_t *rec;
+    int absent;
+
+    h = (khash_t(mate) *) r->mates;
+    k = kh_get(mate, h, qname);
+    if (k != kh_end(h)) {
+        rec = kh_val(h, k);
+        // keep the order of a name-sorted file: first read, then second read
+        if (m->r1 && !rec->m.r1)
+            make_pair(r, p, m, &rec->m);
+        else
+            make_pair(r, p, &rec->m, m);
+        kh_del(mate, h, k);
+        free(rec);
+        r->mem -= MATE_REC_SIZE(l_qname);
+        return 1;
+    }
+
+    if (r->mem + (long) (kh_n_buckets(h) * (sizeof(char *) + sizeof(mate_rec_t *) + 1)) > r->max_mem)
+        spill_mates(r);
+    rec = (mate_rec_t *) malloc(sizeof(mate_rec_t) + l_qname + 1);
+    rec->m = *m;
+    memcpy(rec->qname, qname, l_qname);
+    rec->qname[l_qname] = '\0';
+    k = kh_put(mate, h, rec->qname, &absent);
+    kh_val(h, k) = rec;
+    r->mem += MATE_REC_SIZE(l_qname);
+
+    return 0;
+}
+
+static int read_run(mate_run_t *run)
+{
+    uint8_t l;
+    if (fread(&l, sizeof(uint8_t), 1, run->fp) != 1)
+        return 0;
+    if (fread(run->qname, sizeof(char), l, run->fp) != l ||
+            fread(&run->m, sizeof(bam_mate_t), 1, run->fp) != 1) {
+        fprintf(stderr, "[E::%s] failed to read temporary file\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    run->qname[l] = '\0';
+    return 1;
+}
+
+static inline int run_lt(const mate_run_t *a, const mate_run_t *b)
+{
+    int c = strcmp(a->qname, b->qname);
+    return c < 0 || (c == 0 && a->i < b->i);
+}
+
+static void heap_down(mate_run_t **heap, int n, int i)
+{
+    int c;
+    mate_run_t *t;
+    while ((c = 2 * i + 1) < n) {
+        if (c + 1 < n && run_lt(heap[c + 1], heap[c]))
+            ++c;
+        if (!run_lt(heap[c], heap[i]))
+            break;
+        t = heap[i], heap[i] = heap[c], heap[c] = t;
+        i = c;
+    }
+}
+
+// take the next mate in read name order from the runs, return 0 if all runs are consumed
+static int pop_run(bam_pair_reader_t *r, bam_mate_t *m, char *qname)
+{
+    mate_run_t *run;
+    if (r->n_heap == 0)
+        return 0;
+    run = r->heap[0];
+    *m = run->m;
+    strcpy(qname, run->qname);
+    if (!read_run(run))
+        r->heap[0] = r->heap[--r->n_heap];
+    heap_down(r->heap, r->n_heap, 0);
+    return 1;
+}
+
+static void merge_runs_init(bam_pair_reader_t *r)
+{
+    int i;
+    spill_mates(r);
+    fprintf(stderr, "[I::%s] merge %d runs of unpaired mates\n", __func__, r->n_run);
+    r->heap = (mate_run_t **) malloc((r->n_run + 1) * sizeof(mate_run_t *));
+    r->n_heap = 0;
+    for (i = 0; i < r->n_run; ++i)
+        if (read_run(r->run[i]))
+            r->heap[r->n_heap++] = r->run[i];
+    for (i = r->n_heap / 2 - 1; i >= 0; --i)
+        heap_down(r->heap, r->n_heap, i);
+    r->buff = 0;
+}
+
+static int merge_runs_read(bam_pair_reader_t *r, hic_pair_t *p)
+{
+    bam_mate_t m;
+    char qname[256];
+    while (pop_run(r, &m, qname)) {
+        if (r->buff && strcmp(r->qname, qname) == 0) {
+            if (m.r1 && !r->mate.r1)
+                make_pair(r, p, &m, &r->mate);
+            else
+                make_pair(r, p, &r->mate, &m);
+            r->buff = 0;
+            return 1;
+        }
+        r->mate = m;
+        strcpy(r->qname, qname);
+        r->buff = 1;
+    }
+    return 0;
+}
+
+// return 1 for a read pair and 0 at the end of file
+// records are parsed in place, no memory is allocated per record for name-sorted files
+int bam_pair_read(bam_pair_reader_t *r, hic_pair_t *p)
+{
+    uint8_t *d;
+    const char *qname;
+    bam_mate_t m;
+    int ret, l_qname, is_pair;
+
+    if (r->eof)
+        return r->n_run? merge_runs_read(r, p) : 0;
+
+    while ((ret = bam_read1_raw(r->fp, &d)) >= 0) {
+        // 0x4 0x100 0x800, duplicates are kept and flagged
+        if (bam_raw_flag(d) & 0x904)
+            continue;
+        m.tid = bam_raw_tid(d);
+        if (m.tid < 0 || m.tid >= r->h->n_targets)
+            continue;
+        m.q = bam_raw_qual(d);
+        m.r1 = !!(bam_raw_flag(d) & BAM_FREAD1);
+        m.dup = !!(bam_raw_flag(d) & BAM_FDUP);
+        if (m.q < r->mq) {
+            m.s = -1;
+            m.e = -1;
+        } else {
+            m.s = bam_raw_pos(d) + 1;
+            m.e = get_target_end(d, bam_raw_pos(d)) + 1;
+        }
+        qname = bam_raw_qname(d);
+        l_qname = strnlen(qname, bam_raw_l_qname(d));
+
+        if (r->coord) {
+            is_pair = join_mate(r, p, &m, qname, l_qname);
+        } else {
+            is_pair = r->buff && r->l_qname == l_qname && memcmp(r->qname, qname, l_qname) == 0;
+            if (is_pair) {
+                make_pair(r, p, &r->mate, &m);
+                r->buff = 0;
+            } else {
+                r->mate = m;
+                r->l_qname = l_qname;
+                memcpy(r->qname, qname, l_qname);
+                r->qname[l_qname] = '\0';
+                r->buff = 1;
+            }
+        }
+
+        if (++r->rec_c % 1000000 == 0)
+            fprintf(stderr, "[I::%s] %ld million records processed, %ld read pairs \n", __func__, r->rec_c / 1000000, r->pair_c);
+
+        if (is_pair)
+            return 1;
+    }
+
+    if (ret < -1)
+        fprintf(stderr, "[W::%s] truncated BAM record, stop reading\n", __func__);
+
+    r->eof = 1;
+    if (r->n_run) {
+        merge_runs_init(r);
+        return merge_runs_read(r, p);
+    }
+
+    return 0;
+}
+
+/********************
+ * text pair reader *
+ ********************/
+
+#define TXT_BLOCK_SIZE (1 << 25)
+
+KHASH_SET_INIT_STR(str)
+
+static inline int is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+// split a line into at most n tokens, which are terminated in place
+static int tokenize(char *s, char *e, char **tok, int n)
+{
+    int i = 0;
+    while (s < e && i < n) {
+        while (s < e && is_space(*s)) ++s;
+        if (s == e) break;
+        tok[i++] = s;
+        while (s < e && !is_space(*s)) ++s;
+        if (s < e) *s++ = '\0';
+    }
+    return i;
+}
+
+static inline uint32_t parse_u32(const char *s)
+{
+    uint32_t x = 0;
+    while (*s >= '0' && *s <= '9')
+        x = x * 10 + (*s++ - '0');
+    return x;
+}
+
+static int is_uint(const char *s, const char *e)
+{
+    if (s == e) return 0;
+    for (; s < e && !is_space(*s); ++s)
+        if (*s < '0' || *s > '9')
+            return 0;
+    return 1;
+}
+
+static inline uint32_t mid_pos_u32(uint32_t s, uint32_t e)
+{
+    return s / 2 + e / 2 + (s & 1 && e & 1);
+}
+
+static char empty_str[1] = "";
+
+// unmapped mates in BEDPE (".") and pairs ("!")
+static inline int is_unmapped(const char *cname)
+{
+    return (cname[0] == '.' || cname[0] == '!') && cname[1] == '\0';
+}
+
+static void parse_txt_chunk(void *data, long i, int tid)
+{
+    txt_pair_reader_t *r = (txt_pair_reader_t *) data;
+    txt_chunk_t *c = &r->chunk[i];
+    char *s, *e, *end, *tok[64];
+    txt_rec_t *rec;
+    int n;
+    const int *col = r->col;
+
+    c->n = 0;
+    s = r->buf + c->beg;
+    end = r->buf + c->end;
+    for (; s < end; s = e + 1) {
+        for (e = s; e < end && *e != '\n'; ++e);
+        if (e == s || *s == '#')
+            continue;
+        *e = '\0';
+        if (c->n == c->m) {
+            c->m = c->m? c->m << 1 : 1024;
+            c->a = (txt_rec_t *) realloc(c->a, c->m * sizeof(txt_rec_t));
+        }
+        rec = &c->a[c->n];
+        rec->q[0] = rec->q[1] = 255;
+        rec->dup = 0;
+        if (r->fmt == PAIR_FMT_PAIRS) {
+            // readID chr1 pos1 chr2 pos2 ..., columns might be reordered in the header
+            n = tokenize(s, e, tok, r->n_col);
+            if (n < r->n_col) continue;
+            rec->rn = tok[col[0]];
+            rec->cn[0] = tok[col[1]];
+            rec->cn[1] = tok[col[3]];
+            rec->p[0] = parse_u32(tok[col[2]]);
+            rec->p[1] = parse_u32(tok[col[4]]);
+            if (col[5] >= 0) rec->q[0] = MIN(parse_u32(tok[col[5]]), 255);
+            if (col[6] >= 0) rec->q[1] = MIN(parse_u32(tok[col[6]]), 255);
+            if (col[7] >= 0) rec->dup = strcmp(tok[col[7]], "DD") == 0;
+            rec->c[0] = is_unmapped(rec->cn[0])? UINT32_MAX : sd_get(r->dict, rec->cn[0]);
+            rec->c[1] = is_unmapped(rec->cn[1])? UINT32_MAX : sd_get(r->dict, rec->cn[1]);
+        } else if (r->fmt == PAIR_FMT_BEDPE) {
+            // chrom1 start1 end1 chrom2 start2 end2 [name ...]
+            n = tokenize(s, e, tok, 7);
+            if (n < 6) continue;
+            rec->cn[0] = tok[0];
+            rec->cn[1] = tok[3];
+            rec->p[0] = mid_pos_u32(parse_u32(tok[1]), parse_u32(tok[2]));
+            rec->p[1] = mid_pos_u32(parse_u32(tok[4]), parse_u32(tok[5]));
+            rec->rn = n > 6? tok[6] : empty_str;
+            rec->c[0] = is_unmapped(rec->cn[0])? UINT32_MAX : sd_get(r->dict, rec->cn[0]);
+            rec->c[1] = is_unmapped(rec->cn[1])? UINT32_MAX : sd_get(r->dict, rec->cn[1]);
+        } else {
+            // chrom start end name [...]
+            n = tokenize(s, e, tok, 4);
+            if (n < 3) continue;
+            rec->cn[0] = tok[0];
+            rec->cn[1] = 0;
+            rec->p[0] = mid_pos_u32(parse_u32(tok[1]), parse_u32(tok[2]));
+            rec->rn = n > 3? tok[3] : empty_str;
+            rec->c[0] = sd_get(r->dict, rec->cn[0]);
+        }
+        rec->l_rn = strlen(rec->rn);
+        ++c->n;
+    }
+}
+
+static void detect_txt_format(txt_pair_reader_t *r)
+{
+    char *s, *e, *end, *t;
+    int i;
+    end = r->buf + r->l_blk;
+    for (s = r->buf; s < end; s = e + 1) {
+        for (e = s; e < end && *e != '\n'; ++e);
+        if (e == s || *s == '#')
+            continue;
+        // BEDPE if the 5th and 6th columns are coordinates; BED has score and strand there
+        for (t = s, i = 0; i < 6 && t < e; ++i) {
+            while (t < e && is_space(*t)) ++t;
+            if (t == e) break;
+            if (i >= 4 && !is_uint(t, e))
+                return;
+            while (t < e && !is_space(*t)) ++t;
+        }
+        if (i == 6)
+            r->fmt = PAIR_FMT_BEDPE;
+        return;
+    }
+}
+
+// parse "#columns:" and "#chromsize:" lines of a pairs header at the start of the block
+static void parse_pairs_header(txt_pair_reader_t *r)
+{
+    // column names in the 4DN specification and their pairtools aliases
+    static const char *names[8] = {"readID", "chr1", "pos1", "chr2", "pos2", "mapq1", "mapq2", "pair_type"};
+    static const char *alias[8] = {"readID", "chrom1", "pos1", "chrom2", "pos2", "mapq1", "mapq2", "pair_type"};
+    char *s, *e, *end, *tok[66];
+    int i, j, n;
+    uint32_t id, len;
+
+    end = r->buf + r->l_blk;
+    for (s = r->buf; s < end; s = e + 1) {
+        for (e = s; e < end && *e != '\n'; ++e);
+        if (e == s)
+            continue;
+        if (*s != '#') {
+            r->hdr = 1;
+            break;
+        }
+        *e = '\0';
+        if (strncmp(s, "#columns:", 9) == 0) {
+            n = tokenize(s + 9, e, tok, 64);
+            for (j = 0; j < 8; ++j) {
+                r->col[j] = -1;
+                for (i = 0; i < n; ++i)
+                    if (strcmp(tok[i], names[j]) == 0 || strcmp(tok[i], alias[j]) == 0)
+                        r->col[j] = i;
+                if (j < 5 && r->col[j] < 0) {
+                    fprintf(stderr, "[E::%s] column \"%s\" not found in pairs header\n", __func__, names[j]);
+                    exit(EXIT_FAILURE);
+                }
+                if (r->col[j] >= 0 && r->col[j] + 1 > r->n_col)
+                    r->n_col = r->col[j] + 1;
+            }
+        } else if (strncmp(s, "#chromsize:", 11) == 0) {
+            n = tokenize(s + 11, e, tok, 2);
+            id = n == 2? sd_get(r->dict, tok[0]) : UINT32_MAX;
+            len = n == 2? parse_u32(tok[1]) : 0;
+            if (id != UINT32_MAX && r->dict->s[id].len != len)
+                fprintf(stderr, "[W::%s] sequence \"%s\" length mismatch: %u in pairs header, %u in FASTA index\n", __func__, tok[0], len, r->dict->s[id].len);
+        }
+        if (e < end)
+            *e = '\n';
+    }
+}
+
+// read the next block of complete lines and parse it, return 0 at the end of file
+static int read_txt_block(txt_pair_reader_t *r)
+{
+    size_t l, k;
+    int i, n, n_chunk;
+    char *p;
+
+    if (r->eof)
+        return 0;
+    // names of the buffered mate point into the old block
+    if (r->buff && r->mate.rn != r->carry) {
+        l = r->mate.l_rn + strlen(r->mate.cn[0]) + 2;
+        if (l > r->m_carry) {
+            r->m_carry = l;
+            r->carry = (char *) realloc(r->carry, r->m_carry);
+        }
+        memmove(r->carry, r->mate.rn, r->mate.l_rn + 1);
+        strcpy(r->carry + r->mate.l_rn + 1, r->mate.cn[0]);
+        r->mate.rn = r->carry;
+        r->mate.cn[0] = r->carry + r->mate.l_rn + 1;
+    }
+    // keep the partial line
+    memmove(r->buf, r->buf + r->l_blk, r->l_buf - r->l_blk);
+    r->l_buf -= r->l_blk;
+    r->l_blk = 0;
+    while (1) {
+        while (r->l_buf < r->m_buf - 1) {
+            n = bam_read(r->fp, r->buf + r->l_buf, r->m_buf - 1 - r->l_buf);
+            if (n < 0) {
+                fprintf(stderr, "[E::%s] failed to read input file\n", __func__);
+                exit(EXIT_FAILURE);
+            }
+            if (n == 0) {
+                r->eof = 1;
+                break;
+            }
+            r->l_buf += n;
+        }
+        for (p = r->buf + r->l_buf; p > r->buf && *(p - 1) != '\n'; --p);
+        if (p > r->buf || r->eof)
+            break;
+        // a line longer than the block
+        r->m_buf <<= 1;
+        r->buf = (char *) realloc(r->buf, r->m_buf);
+    }
+    if (r->eof) {
+        r->l_blk = r->l_buf;
+    } else {
+        r->l_blk = p - r->buf;
+    }
+    if (r->l_blk == 0)
+        return 0;
+
+    if (r->rec_c == 0 && r->fmt == PAIR_FMT_BED)
+        detect_txt_format(r);
+    if (!r->hdr && r->fmt == PAIR_FMT_PAIRS)
+        parse_pairs_header(r);
+
+    // split the block at line boundaries
+    n_chunk = r->n_chunk;
+    for (i = 0, k = 0; i < n_chunk; ++i) {
+        r->chunk[i].beg = k;
+        l = i == n_chunk - 1? r->l_blk : MAX(k, r->l_blk / n_chunk * (i + 1));
+        while (l > k && l < r->l_blk && r->buf[l - 1] != '\n') ++l;
+        r->chunk[i].end = k = l;
+    }
+    kt_for(r->n_threads, parse_txt_chunk, r, n_chunk);
+    r->i_chunk = 0;
+    r->i_rec = 0;
+
+    return 1;
+}
+
+txt_pair_reader_t *txt_pair_reader_open(const char *f, sdict_t *dict, int fmt, int n_threads)
+{
+    txt_pair_reader_t *r;
+
+    r = (txt_pair_reader_t *) calloc(1, sizeof(txt_pair_reader_t));
+    r->fp = bam_open_mt(f, "r", n_threads);
+    if (r->fp == NULL) {
+        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
+        exit(EXIT_FAILURE);
+    }
+    r->dict = dict;
+    r->fmt = fmt;
+    r->n_threads = n_threads;
+    // default pairs columns
+    r->n_col = 5;
+    r->col[0] = 0, r->col[1] = 1, r->col[2] = 2, r->col[3] = 3, r->col[4] = 4;
+    r->col[5] = r->col[6] = r->col[7] = -1;
+    r->n_chunk = n_threads > 1? n_threads * 4 : 1;
+    r->chunk = (txt_chunk_t *) calloc(r->n_chunk, sizeof(txt_chunk_t));
+    r->m_buf = TXT_BLOCK_SIZE;
+    r->buf = (char *) malloc(r->m_buf);
+    r->absent = kh_init(str);
+
+    return r;
+}
+
+void txt_pair_reader_close(txt_pair_reader_t *r)
+{
+    khash_t(str) *h;
+    khint_t k;
+    int i;
+
+    h = (khash_t(str) *) r->absent;
+    for (k = kh_begin(h); k != kh_end(h); ++k)
+        if (kh_exist(h, k))
+            free((char *) kh_key(h, k));
+    kh_destroy(str, h);
+    for (i = 0; i < r->n_chunk; ++i)
+        free(r->chunk[i].a);
+    free(r->chunk);
+    free(r->buf);
+    free(r->carry);
+    bam_close(r->fp);
+    free(r);
+}
+
+static void make_txt_pair(txt_pair_reader_t *r, hic_pair_t *p, const txt_rec_t *m0, int i0, const txt_rec_t *m1, int i1)
+{
+    khash_t(str) *h;
+    khint_t k;
+    const char *cname;
+    int absent;
+
+    ++r->pair_c;
+    p->c0 = m0->c[i0];
+    p->c1 = m1->c[i1];
+    p->p0 = m0->p[i0];
+    p->p1 = m1->p[i1];
+    p->q0 = m0->q[i0];
+    p->q1 = m1->q[i1];
+    p->dup = m0->dup | m1->dup;
+    if (p->c0 == UINT32_MAX || p->c1 == UINT32_MAX) {
+        cname = p->c0 == UINT32_MAX? m0->cn[i0] : m1->cn[i1];
+        if (is_unmapped(cname))
+            return;
+        h = (khash_t(str) *) r->absent;
+        k = kh_put(str, h, cname, &absent);
+        if (absent) {
+            kh_key(h, k) = strdup(cname);
+            fprintf(stderr, "[W::txt_pair_read] sequence \"%s\" not found \n", cname);
+        }
+    }
+}
+
+// two mates of a read pair in BED have the same read name, or names differing in the last two characters (/1 and /2)
+static inline int is_txt_mate(const txt_rec_t *m0, const txt_rec_t *m1)
+{
+    if (m0->l_rn != m1->l_rn)
+        return 0;
+    if (m0->l_rn < 2)
+        return memcmp(m0->rn, m1->rn, m0->l_rn) == 0;
+    return memcmp(m0->rn, m1->rn, m0->l_rn - 2) == 0;
+}
+
+// return 1 for a read pair and 0 at the end of file
+int txt_pair_read(txt_pair_reader_t *r, hic_pair_t *p)
+{
+    txt_chunk_t *c;
+    txt_rec_t *rec;
+    int is_pair;
+
+    while (1) {
+        while (r->i_chunk < r->n_chunk && r->i_rec == r->chunk[r->i_chunk].n) {
+            ++r->i_chunk;
+            r->i_rec = 0;
+        }
+        if (r->i_chunk == r->n_chunk || r->l_blk == 0) {
+            if (!read_txt_block(r))
+                return 0;
+            continue;
+        }
+        c = &r->chunk[r->i_chunk];
+        rec = &c->a[r->i_rec++];
+
+        if (r->fmt != PAIR_FMT_BED) {
+            make_txt_pair(r, p, rec, 0, rec, 1);
+            is_pair = 1;
+        } else {
+            is_pair = r->buff && is_txt_mate(&r->mate, rec);
+            if (is_pair) {
+                make_txt_pair(r, p, &r->mate, 0, rec, 0);
+                r->buff = 0;
+            } else {
+                r->mate = *rec;
+                r->buff = 1;
+            }
+        }
+
+        if (++r->rec_c % 1000000 == 0)
+            fprintf(stderr, "[I::%s] %ld million records processed, %ld read pairs \n", __func__, r->rec_c / 1000000, r->pair_c);
+
+        if (is_pair)
+            return 1;
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,135 @@
+/*********************************************************************************
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2021 Chenxi Zhou <chnx.zhou@gmail.com>                          *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in    *
+ * all copies or substantial portions of the Software.                           *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *********************************************************************************/
+
+/********************************** Revision History *****************************
+ *                                                                               *
+ * 18/10/26 - agent: Created                                                     *
+ *                                                                               *
+ *********************************************************************************/
+#ifndef PAIRS_H_
+#define PAIRS_H_
+
+#include <stdint.h>
+
+#include "bamlite.h"
+#include "sdict.h"
+
+typedef struct {
+    uint32_t c0, c1; // sequence id in the dictionary, UINT32_MAX if absent
+    uint32_t p0, p1; // alignment middle position
+    uint8_t q0, q1; // mapping quality
+    uint8_t dup; // marked as duplicate
+} hic_pair_t;
+
+typedef struct {
+    int32_t tid, s, e; // target id, alignment start and end, -1 if below the mapping quality threshold
+    uint8_t q, r1, dup; // mapping quality, first read in the pair, marked as duplicate
+} bam_mate_t;
+
+typedef struct mate_run_s mate_run_t;
+
+// read pairs from a BAM file sorted by read name or by coordinate
+// mates in a coordinate-sorted file are joined by read name in a hash table,
+// which is spilled to sorted runs on disk when it exceeds max_mem and merged at the end
+typedef struct {
+    bamFile fp;
+    bam_header_t *h;
+    sdict_t *dict;
+    uint8_t mq; // pairs below the threshold are reported but not checked for absent sequences
+    uint32_t *tid2id; // BAM target id -> sequence id
+    uint8_t *warned; // absent sequences reported
+    int buff; // mate buffered
+    bam_mate_t mate; // buffered mate
+    int l_qname;
+    char qname[256];
+    long rec_c, pair_c;
+    // coordinate-sorted input
+    int coord;
+    long max_mem, mem; // memory limit and current usage of the mate table
+    void *mates; // read name -> unpaired mate
+    char *tmp; // prefix of spilled run files
+    int n_run, m_run, n_heap, eof;
+    mate_run_t **run; // spilled runs
+    mate_run_t **heap; // runs being merged
+} bam_pair_reader_t;
+
+enum {
+    PAIR_FMT_BED, // two lines per pair, or one line per pair (BEDPE)
+    PAIR_FMT_BEDPE,
+    PAIR_FMT_PAIRS // 4DN pairs
+};
+
+typedef struct {
+    char *rn; // read name
+    char *cn[2]; // sequence name
+    uint32_t l_rn;
+    uint32_t c[2]; // sequence id
+    uint32_t p[2]; // position
+    uint8_t q[2]; // mapping quality, 255 if not available
+    uint8_t dup; // duplicate pair type "DD" in pairs
+} txt_rec_t;
+
+typedef struct {
+    size_t beg, end; // line-aligned range in the block
+    size_t n, m;
+    txt_rec_t *a;
+} txt_chunk_t;
+
+// read pairs from text files in large blocks, lines are tokenized in place and in parallel
+typedef struct {
+    bamFile fp; // plain, gzip or BGZF compressed
+    sdict_t *dict;
+    int fmt, n_threads, eof;
+    int hdr; // header parsed
+    int n_col, col[8]; // pairs columns: readID, chr1, pos1, chr2, pos2, mapq1, mapq2, pair_type
+    size_t l_buf, m_buf, l_blk;
+    char *buf; // block of complete lines followed by a partial line
+    int n_chunk, i_chunk;
+    size_t i_rec;
+    txt_chunk_t *chunk;
+    int buff; // mate buffered
+    txt_rec_t mate;
+    size_t m_carry;
+    char *carry; // names of the buffered mate once its block is gone
+    void *absent; // absent sequences reported
+    long rec_c, pair_c;
+} txt_pair_reader_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bam_pair_reader_t *bam_pair_reader_open(const char *f, sdict_t *dict, uint8_t mq, int n_threads, long max_mem, const char *tmp);
+int bam_pair_read(bam_pair_reader_t *r, hic_pair_t *p);
+void bam_pair_reader_close(bam_pair_reader_t *r);
+txt_pair_reader_t *txt_pair_reader_open(const char *f, sdict_t *dict, int fmt, int n_threads);
+int txt_pair_read(txt_pair_reader_t *r, hic_pair_t *p);
+void txt_pair_reader_close(txt_pair_reader_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PAIRS_H_ */
+
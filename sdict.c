@@ -66,7 +66,7 @@ asm_dict_t *asm_init(sdict_t *sdict)
     d->u = 0;
     d->v = 16;
     d->seg = (sd_seg_t *) malloc(d->v * sizeof(sd_seg_t));
-    d->a = (uint32_t *) malloc(sdict->n * sizeof(uint32_t));
+    d->a = (uint32_t *) malloc((sdict->n + 1) * sizeof(uint32_t));
     d->index = 0;
     d->sdict = sdict;
     return d;
@@ -284,6 +284,20 @@ uint32_t asm_sd_get(asm_dict_t *d, const char *name)
     return k == kh_end(h)? UINT32_MAX : kh_val(h, k);
 }
 
+// return 1 if every scaffold is made of segments of a single sequence
+int asm_single_seq_scaffolds(asm_dict_t *d)
+{
+    uint32_t i, j;
+    sd_aseq_t *s;
+    for (i = 0; i < d->n; ++i) {
+        s = &d->s[i];
+        for (j = 1; j < s->n; ++j)
+            if (d->seg[s->s + j].c >> 1 != d->seg[s->s].c >> 1)
+                return 0;
+    }
+    return 1;
+}
+
 static void seg_put(asm_dict_t *d, uint32_t s, uint32_t k, uint64_t a, uint32_t c, uint32_t x, uint32_t y)
 {
     if (d->u == d->v) {
@@ -307,6 +321,7 @@ asm_dict_t *make_asm_dict_from_sdict(sdict_t *sdict)
         a[i] = i;
         d->index[i] = (uint64_t) sdict->s[i].len << 32 | i;
     }
+    a[sdict->n] = sdict->n;
     return d;
 }
 
@@ -317,7 +332,8 @@ KRADIX_SORT_INIT(pair, c_pair_t, pair_key, 8)
 
 void asm_index(asm_dict_t *d)
 {
-    int32_t i, s, c, c1;
+    int32_t i, s;
+    uint32_t c, c1;
     sd_seg_t seg;
     uint64_t x, y;
     uint32_t *a;
@@ -341,16 +357,17 @@ void asm_index(asm_dict_t *d)
     if (d->index)
         free(d->index);
     d->index = (uint64_t *) malloc(s * sizeof(uint64_t));
+    // index entries of sequence c are in [a[c], a[c + 1])
     a = d->a;
-    c1 = INT32_MAX;
+    c = 0;
     for (i = 0; i < s; ++i) {
         d->index[i] = c_pairs[i].y;
-        c = c_pairs[i].x >> 32;
-        if (c != c1) {
-            a[c] = i;
-            c1 = c;
-        }
+        c1 = c_pairs[i].x >> 32;
+        while (c <= c1)
+            a[c++] = i;
     }
+    while (c <= d->sdict->n)
+        a[c++] = s;
 
     free(c_pairs);
 }
@@ -439,25 +456,46 @@ void add_unplaced_short_seqs(asm_dict_t *d, uint32_t min_len)
     asm_index(d);
 }
 
-int sd_coordinate_conversion(asm_dict_t *d, uint32_t id, uint32_t pos, uint32_t *s, uint64_t *p, int count_gap)
+static inline int asm_convert(asm_dict_t *d, uint32_t id, uint32_t pos, uint32_t *s, uint64_t *p, int count_gap)
 {
-    if (id == UINT32_MAX) {
+    const uint64_t *b;
+    const sd_seg_t *seg;
+    uint32_t n, h;
+
+    if (id == UINT32_MAX || (n = d->a[id + 1] - d->a[id]) == 0) {
         *s = UINT32_MAX;
         return 1;
     }
-    uint32_t i;
-    uint64_t *index = d->index;
-    i = d->a[id];
-    while (index[i]>>32 < pos) 
-        ++i;
-    sd_seg_t seg = d->seg[(uint32_t) index[i]];
-    *s = seg.s;
-    *p = seg.c & 1? seg.a + seg.x + seg.y - pos : seg.a + pos - seg.x;
+    // branchless search for the first segment ending at or after pos
+    b = d->index + d->a[id];
+    while (n > 1) {
+        h = n >> 1;
+        b = b[h - 1] >> 32 < pos? b + h : b;
+        n -= h;
+    }
+    seg = &d->seg[(uint32_t) *b];
+    *s = seg->s;
+    *p = seg->c & 1? seg->a + seg->x + seg->y - pos : seg->a + pos - seg->x;
     if (count_gap)
-        *p = *p + seg.k * GAP_SZ;
+        *p = *p + seg->k * GAP_SZ;
     return 0;
 }
 
+int sd_coordinate_conversion(asm_dict_t *d, uint32_t id, uint32_t pos, uint32_t *s, uint64_t *p, int count_gap)
+{
+    return asm_convert(d, id, pos, s, p, count_gap);
+}
+
+// convert n read pairs (id0, pos0, id1, pos1) in a, scaffold ids and positions of the two mates go to s[2i, 2i+1] and p[2i, 2i+1]
+void sd_coordinate_conversion_pairs(asm_dict_t *d, const uint32_t *a, uint32_t n, uint32_t *s, uint64_t *p, int count_gap)
+{
+    uint32_t i;
+    for (i = 0; i < n; ++i) {
+        asm_convert(d, a[i * 4], a[i * 4 + 1], &s[i * 2], &p[i * 2], count_gap);
+        asm_convert(d, a[i * 4 + 2], a[i * 4 + 3], &s[i * 2 + 1], &p[i * 2 + 1], count_gap);
+    }
+}
+
 int cmp_uint64_d (const void *a, const void *b) {
     // decreasing order
     uint64_t x, y;
@@ -75,7 +75,7 @@ typedef struct {
     sdhash_t *h; // sequence hash map: name -> index
     uint32_t u, v; // u: seg number, v: seg memory allocated
     sd_seg_t *seg; // segments
-    uint32_t *a; // sub sequence index map: id -> start pos, need this to deal with sub seq breaks
+    uint32_t *a; // sub sequence index map: id -> start pos, need this to deal with sub seq breaks, a[n] is the end
     uint64_t *index; // sub seq end << 32 | seg index, used to find the seg index given a sub seq position
     sdict_t *sdict; // sub sequence dictionary
 } asm_dict_t;
@@ -100,7 +100,9 @@ asm_dict_t *make_asm_dict_from_agp(sdict_t *sdict, const char *f);
 void add_unplaced_short_seqs(asm_dict_t *d, uint32_t min_len);
 char *get_asm_seq(asm_dict_t *d, char *name);
 uint32_t asm_sd_get(asm_dict_t *d, const char *name);
+int asm_single_seq_scaffolds(asm_dict_t *d);
 int sd_coordinate_conversion(asm_dict_t *d, uint32_t id, uint32_t pos, uint32_t *s, uint64_t *p, int count_gap);
+void sd_coordinate_conversion_pairs(asm_dict_t *d, const uint32_t *a, uint32_t n, uint32_t *s, uint64_t *p, int count_gap);
 void sd_stats(sdict_t *d, uint64_t *n_stats, uint32_t *l_stats);
 void asm_sd_stats(asm_dict_t *d, uint64_t *n_stats, uint32_t *l_stats);
 void write_fasta_file_from_agp(const char *fa, const char *agp, FILE *fo, int line_wd);
@@ -36,10 +36,12 @@
 #include "kvec.h"
 #include "sdict.h"
 #include "link.h"
+#include "binio.h"
 #include "graph.h"
 #include "break.h"
 #include "enzyme.h"
 #include "asset.h"
+#include "kthread.h"
 
 #undef DEBUG
 #undef DEBUG_ERROR_BREAK
@@ -55,7 +57,6 @@
 #define ENOMEM_ERR 15
 #define ENOBND_ERR 14
 #define GB 0x40000000
-#define MAX_N_SEQ 45000
 
 #ifndef DEBUG_GT4G
 static int ec_min_window = 1000000;
@@ -77,22 +78,55 @@ static double ec_fold_thresh = .2;
 
 double qbinom(double, double, double, int, int);
 
+// quality filter thresholds of the round indexed by the number of cells
+KHASH_MAP_INIT_INT(qla, double)
+
+typedef struct {
+    khash_t(qla) *h;
+    double la;
+} qla_fill_t;
+
+static void qla_fill(void *data, long i, int tid)
+{
+    qla_fill_t *d = (qla_fill_t *) data;
+    uint32_t n0;
+
+    if (kh_exist(d->h, i)) {
+        n0 = kh_key(d->h, i);
+        kh_val(d->h, i) = qbinom(.99, n0, d->la, 1, 0) / n0;
+    }
+}
+
 int VERBOSE = 0;
 
-graph_t *build_graph_from_links(inter_link_mat_t *link_mat, asm_dict_t *dict, double min_norm, double la)
+graph_t *build_graph_from_links(inter_link_mat_t *link_mat, asm_dict_t *dict, double min_norm, double la, int n_threads)
 {
     int32_t i, j, n, c0, c1;
     int8_t t;
+    int absent;
     double norm, qla;
     inter_link_t *link;
     graph_t *g;
     graph_arc_t *arc;
+    qla_fill_t data;
+#ifdef DEBUG_QLF
+    uint64_t n_qla = 0;
+#endif
 
     g = graph_init();
     g->sdict = dict;
 
-    // build graph
+    // la is fixed for the round so the threshold only depends on n0
+    // compute the one of each distinct n0 in parallel
+    data.h = kh_init(qla);
+    data.la = la;
     n = link_mat->n;
+    for (i = 0; i < n; ++i)
+        if (link_mat->links[i].n && link_mat->links[i].linkt)
+            kh_put(qla, data.h, link_mat->links[i].n0, &absent);
+    kt_for(n_threads, qla_fill, &data, kh_end(data.h));
+
+    // build graph, arcs are added in the order of the pairs
     for (i = 0; i < n; ++i) {
         link = &link_mat->links[i];
         if (link->n == 0)
@@ -103,7 +137,10 @@ graph_t *build_graph_from_links(inter_link_mat_t *link_mat, asm_dict_t *dict, do
         if (!t)
             continue;
         
-        qla = qbinom(.99, link->n0, la, 1, 0) / link->n0;
+        qla = kh_val(data.h, kh_get(qla, data.h, link->n0));
+#ifdef DEBUG_QLF
+        ++n_qla;
+#endif
         for (j = 0; j < 4; ++j) {
             if (1 << j & t) {
                 norm = link->norms[j];
@@ -120,6 +157,10 @@ graph_t *build_graph_from_links(inter_link_mat_t *link_mat, asm_dict_t *dict, do
             }
         }
     }
+#ifdef DEBUG_QLF
+    printf("#QL filter thresholds: %lu lookups, %u computed, %.2f%% cache hits\n", n_qla, kh_size(data.h), n_qla? 100. * (n_qla - kh_size(data.h)) / n_qla : .0);
+#endif
+    kh_destroy(qla, data.h);
 
     graph_arc_sort(g);
     graph_arc_index(g);
@@ -127,7 +168,7 @@ graph_t *build_graph_from_links(inter_link_mat_t *link_mat, asm_dict_t *dict, do
     return g;
 }
 
-int run_scaffolding(char *fai, char *agp, char *link_file, uint32_t ml, re_cuts_t *re_cuts, char *out, int resolution, double *noise, long rss_limit)
+int run_scaffolding(char *fai, char *agp, char *link_file, contact_cache_t *cc, uint32_t ml, uint8_t mq, re_cuts_t *re_cuts, char *out, int resolution, double *noise, long rss_limit, int n_threads)
 {
     //TODO: adjust wt thres by resolution
     sdict_t *sdict = make_sdict_from_index(fai, ml);
@@ -155,7 +196,9 @@ int run_scaffolding(char *fai, char *agp, char *link_file, uint32_t ml, re_cuts_
     }
     rss_limit -= rss_intra;
     fprintf(stderr, "[I::%s] starting norm estimation...\n", __func__);
-    intra_link_mat_t *intra_link_mat = intra_link_mat_from_file(link_file, dict, re_cuts, resolution, 1);
+    // collect inter-scaffold links in the same pass to avoid a second file scan
+    inter_link_buf_t *inter_link_buf = inter_link_buf_init(cc? 0 : rss_limit);
+    intra_link_mat_t *intra_link_mat = intra_link_mat_from_file(link_file, cc, dict, re_cuts, resolution, 1, mq, inter_link_buf, n_threads);
 
 #ifdef DEBUG_RAM_USAGE
     printf("[I::%s] RAM  peak: %.3fGB\n", __func__, (double) peakrss() / GB);
@@ -163,28 +206,50 @@ int run_scaffolding(char *fai, char *agp, char *link_file, uint32_t ml, re_cuts_
     printf("[I::%s] RAM  free: %.3fGB\n", __func__, (double) rss_limit / GB);
 #endif
 
-    norm_t *norm = calc_norms(intra_link_mat);
+    norm_t *norm = calc_norms(intra_link_mat, n_threads);
     if (norm == 0) {
         fprintf(stderr, "[W::%s] No enough bands for norm calculation... End of scaffolding round.\n", __func__);
         intra_link_mat_destroy(intra_link_mat);
+        inter_link_buf_destroy(inter_link_buf);
         asm_destroy(dict);
         sd_destroy(sdict);
         return ENOBND_ERR;
     }
 
-    rss_inter = estimate_inter_link_mat_init_rss(dict, resolution, norm->r);
-    if ((rss_limit >= 0 && rss_inter > rss_limit) || rss_inter < 0) {
-        // no enough memory
-        fprintf(stderr, "[I::%s] No enough memory. Try higher resolutions... End of scaffolding round.\n", __func__);
+    // each linked sequence pair takes at least one buffered link or cached cell
+    rss_inter = estimate_inter_link_mat_init_rss(dict, resolution, norm->r, inter_link_buf->a? inter_link_buf->n : cc? cc->n : UINT64_MAX);
+    int tiled = (rss_limit >= 0 && rss_inter > rss_limit) || rss_inter < 0;
+    if (tiled) {
+        // no enough memory for the whole matrix, build it tile by tile
+        fprintf(stderr, "[I::%s] No enough memory. Building the inter link matrix in tiles...\n", __func__);
         fprintf(stderr, "[I::%s] RAM    limit: %.3fGB\n", __func__, (double) rss_limit / GB);
         fprintf(stderr, "[I::%s] RAM required: %.3fGB\n", __func__, (double) rss_inter / GB);
-        asm_destroy(dict);
-        sd_destroy(sdict);
-        return ENOMEM_ERR;
+        // keep the buffered links if they leave at least half of the memory to the tiles
+        if (inter_link_buf->a && (long) (inter_link_buf->m * 4 * sizeof(uint32_t)) <= rss_limit / 2) {
+            rss_limit -= inter_link_buf->m * 4 * sizeof(uint32_t);
+        } else {
+            inter_link_buf_destroy(inter_link_buf);
+            inter_link_buf = 0;
+        }
+    } else {
+        rss_limit -= rss_inter;
     }
-    rss_limit -= rss_inter;
     fprintf(stderr, "[I::%s] starting link estimation...\n", __func__);
-    inter_link_mat_t *inter_link_mat = inter_link_mat_from_file(link_file, dict, re_cuts, resolution, norm->r);
+    inter_link_mat_t *inter_link_mat;
+    int8_t *directs = 0;
+    double la;
+    if (tiled) {
+        // norms and directions are estimated along with the tiles
+        inter_link_mat = inter_link_mat_from_tiles(link_file, cc, inter_link_buf, dict, re_cuts, resolution, norm, .1, mq, rss_limit, n_threads, &la);
+        inter_link_buf_destroy(inter_link_buf);
+    } else if (inter_link_buf->a && (long) (inter_link_buf->m * 4 * sizeof(uint32_t)) <= rss_limit) {
+        inter_link_mat = inter_link_mat_from_buf(inter_link_buf, dict, re_cuts, resolution, norm->r, n_threads);
+        inter_link_buf_destroy(inter_link_buf);
+    } else {
+        // buffered links do not fit in memory, rescan the file instead
+        inter_link_buf_destroy(inter_link_buf);
+        inter_link_mat = inter_link_mat_from_file(link_file, cc, dict, re_cuts, resolution, norm->r, mq, n_threads);
+    }
 
 #ifdef DEBUG_RAM_USAGE
     printf("[I::%s] RAM  peak: %.3fGB\n", __func__, (double) peakrss() / GB);
@@ -194,11 +259,11 @@ int run_scaffolding(char *fai, char *agp, char *link_file, uint32_t ml, re_cuts_
 
     *noise = inter_link_mat->noise / resolution / resolution;
 
-    int8_t *directs = 0;
-    double la;
-    // directs = calc_link_directs_from_file(link_file, dict);
-    inter_link_norms(inter_link_mat, norm, 1, &la);
-    calc_link_directs(inter_link_mat, .1, dict, directs);
+    // directs = calc_link_directs_from_file(link_file, dict, mq);
+    if (!tiled) {
+        inter_link_norms(inter_link_mat, norm, 1, &la, n_threads);
+        calc_link_directs(inter_link_mat, .1, dict, directs, n_threads);
+    }
     free(directs);
 
 #ifdef DEBUG
@@ -206,7 +271,7 @@ int run_scaffolding(char *fai, char *agp, char *link_file, uint32_t ml, re_cuts_
 #endif
 
     fprintf(stderr, "[I::%s] starting scaffolding graph contruction...\n", __func__);
-    graph_t *g = build_graph_from_links(inter_link_mat, dict, .1, la);
+    graph_t *g = build_graph_from_links(inter_link_mat, dict, .1, la, n_threads);
 
 #ifdef DEBUG_GRAPH_PRUNE
     printf("[I::%s] scaffolding graph (before pruning) in GV format\n", __func__);
@@ -265,25 +330,26 @@ int run_scaffolding(char *fai, char *agp, char *link_file, uint32_t ml, re_cuts_
     return 0;
 }
 
-int contig_error_break(char *fai, char *link_file, uint32_t ml, char *out)
+int contig_error_break(char *fai, char *link_file, contact_cache_t *cc, uint32_t ml, uint8_t mq, char *out, long rss_limit)
 {
-    uint32_t i, ec_round, err_no, bp_n;
+    uint32_t i, ec_round, err_no, bp_n, dist_thres;
     sdict_t *sdict;
     asm_dict_t *dict;
-    int dist_thres;
 
     sdict = make_sdict_from_index(fai, ml);
-    dict = make_asm_dict_from_sdict(sdict);
-    dist_thres = estimate_dist_thres_from_file(link_file, dict, ec_min_frac, ec_resolution);
-    dist_thres = MAX(dist_thres, ec_min_window);
-    fprintf(stderr, "[I::%s] dist threshold for contig error break: %d\n", __func__, dist_thres);
-    asm_destroy(dict);
 
     char* out1 = (char *) malloc(strlen(out) + 35);
     ec_round = err_no = 0;
     while (1) {
         dict = ec_round? make_asm_dict_from_agp(sdict, out1) : make_asm_dict_from_sdict(sdict);
-        link_mat_t *link_mat = link_mat_from_file(link_file, dict, dist_thres, ec_bin, .0, ec_move_avg);
+        link_mat_t *link_mat;
+        if (ec_round) {
+            link_mat = link_mat_from_file(link_file, cc, dict, dist_thres, ec_bin, .0, ec_move_avg, mq);
+        } else {
+            // the first round estimates the dist threshold from the same pass
+            link_mat = link_mat_from_file_est_dist_thres(link_file, cc, dict, ec_min_frac, ec_min_window, ec_resolution, ec_bin, ec_move_avg, mq, rss_limit, &dist_thres);
+            fprintf(stderr, "[I::%s] dist threshold for contig error break: %u\n", __func__, dist_thres);
+        }
 #ifdef DEBUG_ERROR_BREAK
         printf("[I::%s] ec_round %u link matrix\n", __func__, ec_round);
         print_link_mat(link_mat, dict, stdout);
@@ -316,17 +382,17 @@ int contig_error_break(char *fai, char *link_file, uint32_t ml, char *out)
     return ec_round;
 }
 
-int scaffold_error_break(char *fai, char *link_file, uint32_t ml, char *agp, int flank_size, double noise, char *out)
+int scaffold_error_break(char *fai, char *link_file, contact_cache_t *cc, uint32_t ml, uint8_t mq, char *agp, int flank_size, double noise, char *out)
 {
     int dist_thres;
     sdict_t *sdict = make_sdict_from_index(fai, ml);
     asm_dict_t *dict = make_asm_dict_from_agp(sdict, agp);
 
     dist_thres = flank_size * 2;
-    //dist_thres = estimate_dist_thres_from_file(link_file, dict, ec_min_frac, ec_resolution);
+    //dist_thres = estimate_dist_thres_from_file(link_file, dict, ec_min_frac, ec_resolution, mq);
     //dist_thres = MAX(dist_thres, ec_min_window);
     //fprintf(stderr, "[I::%s] dist threshold for scaffold error break: %d\n", __func__, dist_thres);
-    link_mat_t *link_mat = link_mat_from_file(link_file, dict, dist_thres, ec_bin, noise, ec_move_avg);
+    link_mat_t *link_mat = link_mat_from_file(link_file, cc, dict, dist_thres, ec_bin, noise, ec_move_avg, mq);
 
 #ifdef DEBUG_ERROR_BREAK
     printf("[I::%s] link matrix\n", __func__);
@@ -364,7 +430,7 @@ static void print_asm_stats(uint64_t *n_stats, uint32_t *l_stats)
 #endif
 }
 
-int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, char *out, int *resolutions, int nr, re_cuts_t *re_cuts, int no_contig_ec, int no_scaffold_ec)
+int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t mq, uint32_t cache_bin, char *out, int *resolutions, int nr, re_cuts_t *re_cuts, int no_contig_ec, int no_scaffold_ec, int n_threads)
 {
     int ec_round, re, r, rc;
     char *out_fn, *out_agp, *out_agp_break;
@@ -374,6 +440,7 @@ int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, char *out, int
     FILE *fo;
     sdict_t *sdict;
     asm_dict_t *dict;
+    contact_cache_t *cc;
     long rss_total, rss_limit;  
     
     ram_limit(&rss_total, &rss_limit);
@@ -381,13 +448,23 @@ int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, char *out, int
     fprintf(stderr, "[I::%s] RAM limit: %.3fGB\n", __func__, (double) rss_limit / GB);
 
     sdict = make_sdict_from_index(fai, ml);
+    cc = 0;
+    if (cache_bin) {
+        cc = contact_cache_from_file(link_file, sdict, mq, cache_bin, rss_limit);
+        if (cc) {
+            rss_limit = MAX(0, rss_limit - (long) (cc->n * 5 * sizeof(uint32_t)));
+            fprintf(stderr, "[I::%s] %lu read pairs cached in %lu cells of %u bp\n", __func__, cc->n_pair, cc->n, cache_bin);
+        } else {
+            fprintf(stderr, "[W::%s] contact cache does not fit in the RAM limit %.3fGB, reading the BIN file in each pass instead\n", __func__, (double) rss_limit / GB);
+        }
+    }
     out_fn = (char *) malloc(strlen(out) + 35);
     out_agp = (char *) malloc(strlen(out) + 35);
     out_agp_break = (char *) malloc(strlen(out) + 35);
 
     if (agp == 0 && no_contig_ec == 0) {
         sprintf(out_agp_break, "%s_inital_break", out);
-        ec_round = contig_error_break(fai, link_file, ml, out_agp_break);
+        ec_round = contig_error_break(fai, link_file, cc, ml, mq, out_agp_break, rss_limit);
         sprintf(out_agp_break, "%s_inital_break_%02d.agp", out, ec_round);
     } else {
         if (agp != 0) {
@@ -407,13 +484,6 @@ int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, char *out, int
     l_stats = (uint32_t *) calloc(10, sizeof(uint32_t));
     
     dict = make_asm_dict_from_agp(sdict, out_agp_break);
-    if (dict->n > MAX_N_SEQ) {
-        fprintf(stderr, "[E::%s] sequence number exceeds limit (%d > %d)\n", __func__, dict->n, MAX_N_SEQ);
-        fprintf(stderr, "[E::%s] consider removing short sequences before scaffolding, or\n", __func__);
-        fprintf(stderr, "[E::%s] running without error correction (--no-contig-ec) if due to excessive contig error breaks\n", __func__);
-        fprintf(stderr, "[E::%s] program halted...\n", __func__);
-        return 1;
-    }
     asm_sd_stats(dict, n_stats, l_stats);
     print_asm_stats(n_stats, l_stats);
     asm_destroy(dict);
@@ -434,12 +504,12 @@ int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, char *out, int
 
         sprintf(out_fn, "%s_r%02d", out, r);
         // noise per unit
-        re = run_scaffolding(fai, out_agp_break, link_file, ml, re_cuts, out_fn, resolutions[r - 1], &noise, rss_limit);
+        re = run_scaffolding(fai, out_agp_break, link_file, cc, ml, mq, re_cuts, out_fn, resolutions[r - 1], &noise, rss_limit, n_threads);
         if (!re) {
             sprintf(out_agp, "%s_r%02d.agp", out, r);
             if (no_scaffold_ec == 0) {
                 sprintf(out_agp_break, "%s_r%02d_break.agp", out, r);
-                scaffold_error_break(fai, link_file, ml, out_agp, resolutions[r - 1], noise, out_agp_break);
+                scaffold_error_break(fai, link_file, cc, ml, mq, out_agp, resolutions[r - 1], noise, out_agp_break);
             } else {
                 sprintf(out_agp_break, "%s", out_agp);
             }
@@ -452,6 +522,7 @@ int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, char *out, int
         print_asm_stats(n_stats, l_stats);
         asm_destroy(dict);
     }
+    contact_cache_destroy(cc);
 
     sprintf(out_agp, "%s_scaffolds_final.agp", out);
     // output sorted agp by scaffold size instead of file copy
@@ -527,14 +598,19 @@ static int default_nr(char *fai, uint32_t ml)
 
 static void print_help(FILE *fp_help)
 {
-    fprintf(fp_help, "Usage: yahs [options] <contigs.fa> <hic.bed>|<hic.bam>|<hic.bin>\n");
+    fprintf(fp_help, "Usage: yahs [options] <contigs.fa> <hic.bed>|<hic.bedpe>|<hic.pairs>|<hic.bam>|<hic.bin>\n");
     fprintf(fp_help, "Options:\n");
     fprintf(fp_help, "    -a FILE           AGP file (for rescaffolding) [none]\n");
     fprintf(fp_help, "    -r INT[,INT,...]  list of resolutions in ascending order [automate]\n");
     fprintf(fp_help, "    -e STR            restriction enzyme cutting sites [none]\n");
     fprintf(fp_help, "    -l INT            minimum length of a contig to scaffold [0]\n");
     fprintf(fp_help, "    -q INT            minimum mapping quality [10]\n");
+    fprintf(fp_help, "    -t INT            number of threads [1]\n");
     fprintf(fp_help, "    -o STR            prefix of output files [yahs.out]\n");
+    fprintf(fp_help, "    --bam-mem STR     memory for joining mates in coordinate-sorted BAM and sorting binary file [1G]\n");
+    fprintf(fp_help, "    --block-bin       store binary file records in compressed blocks\n");
+    fprintf(fp_help, "    --sort-bin        sort binary file by contig pair and index it (implies --block-bin)\n");
+    fprintf(fp_help, "    --cache-bin INT   read the binary file once into INT bp bins and build all rounds from it [0]\n");
     fprintf(fp_help, "    -v INT            verbose level [%d]\n", VERBOSE);
     fprintf(fp_help, "    --version         show version number\n");
 }
@@ -542,6 +618,10 @@ static void print_help(FILE *fp_help)
 static ko_longopt_t long_options[] = {
     { "no-contig-ec",   ko_no_argument, 301 },
     { "no-scaffold-ec", ko_no_argument, 302 },
+    { "bam-mem",        ko_required_argument, 303 },
+    { "sort-bin",       ko_no_argument, 304 },
+    { "cache-bin",      ko_required_argument, 305 },
+    { "block-bin",      ko_no_argument, 306 },
     { "help",           ko_no_argument, 'h' },
     { "version",        ko_no_argument, 'V' },
     { 0, 0, 0 }
@@ -557,18 +637,21 @@ int main(int argc, char *argv[])
     }
 
     char *fa, *fai, *agp, *link_file, *out, *restr, *ecstr, *ext, *link_bin_file, *agp_final, *fa_final;
-    int *resolutions, nr, mq, ml, no_contig_ec, no_scaffold_ec;
+    int *resolutions, nr, mq, ml, no_contig_ec, no_scaffold_ec, n_threads, sort_bin, block_bin, cache_bin;
+    long max_mem;
 
-    const char *opt_str = "a:e:r:o:l:q:Vv:h";
+    const char *opt_str = "a:e:r:o:l:q:t:Vv:h";
     ketopt_t opt = KETOPT_INIT;
 
     int c, ret;
     FILE *fp_help = stderr;
     fa = fai = agp = link_file = out = restr = link_bin_file = agp_final = fa_final = 0;
-    no_contig_ec = no_scaffold_ec = 0;
+    no_contig_ec = no_scaffold_ec = sort_bin = block_bin = cache_bin = 0;
     mq = 10;
     ml = 0;
     ecstr = 0;
+    n_threads = 1;
+    max_mem = 1000000000L;
 
     while ((c = ketopt(&opt, argc, argv, 1, opt_str, long_options)) >= 0) {
         if (c == 'a') {
@@ -581,12 +664,22 @@ int main(int argc, char *argv[])
             ml = atoi(opt.arg);
         } else if (c == 'q') {
             mq = atoi(opt.arg);
+        } else if (c == 't') {
+            n_threads = atoi(opt.arg);
         } else if (c == 'e') {
             ecstr = opt.arg;
         } else if (c == 301) {
             no_contig_ec = 1;
         } else if (c == 302) {
             no_scaffold_ec = 1;
+        } else if (c == 303) {
+            max_mem = (long) parse_num(opt.arg);
+        } else if (c == 304) {
+            sort_bin = 1;
+        } else if (c == 305) {
+            cache_bin = atoi(opt.arg);
+        } else if (c == 306) {
+            block_bin = 1;
         } else if (c == 'v') {
             VERBOSE = atoi(opt.arg);
         } else if (c == 'V') {
@@ -624,6 +717,21 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (n_threads < 1) {
+        fprintf(stderr, "[E::%s] invalid number of threads: %d\n", __func__, n_threads);
+        return 1;
+    }
+
+    if (cache_bin < 0) {
+        fprintf(stderr, "[E::%s] invalid cache bin size: %d\n", __func__, cache_bin);
+        return 1;
+    }
+
+    if (max_mem < 1000000L) {
+        fprintf(stderr, "[E::%s] memory for joining BAM mates and sorting should be at least 1M: %ld\n", __func__, max_mem);
+        return 1;
+    }
+
     uint8_t mq8;
     mq8 = (uint8_t) mq;
 
@@ -708,6 +816,9 @@ int main(int argc, char *argv[])
         kv_destroy(enz_cs);
     }
 
+    if (cache_bin > MIN(ec_bin, resolutions[0]))
+        fprintf(stderr, "[W::%s] cache bin size %d is larger than the finest bin size in use %d\n", __func__, cache_bin, MIN(ec_bin, resolutions[0]));
+
     if (out == 0)
         out = "yahs.out";
 
@@ -716,19 +827,30 @@ int main(int argc, char *argv[])
         link_bin_file = malloc(strlen(out) + 5);
         sprintf(link_bin_file, "%s.bin", out);
         fprintf(stderr, "[I::%s] dump hic links (BAM) to binary file %s\n", __func__, link_bin_file);
-        dump_links_from_bam_file(link_file, fai, ml, mq8, link_bin_file);
-    } else if (strcmp(ext, ".bed") == 0) {
+        dump_links_from_bam_file(link_file, fai, link_bin_file, n_threads, max_mem, sort_bin, block_bin);
+    } else if (strcmp(ext, ".bed") == 0 || has_file_ext(link_file, ".bedpe") || has_file_ext(link_file, ".bed.gz") || has_file_ext(link_file, ".bedpe.gz")) {
         link_bin_file = malloc(strlen(out) + 5);
         sprintf(link_bin_file, "%s.bin", out);
         fprintf(stderr, "[I::%s] dump hic links (BED) to binary file %s\n", __func__, link_bin_file);
-        dump_links_from_bed_file(link_file, fai, ml, mq8, link_bin_file);
+        dump_links_from_bed_file(link_file, fai, link_bin_file, n_threads, max_mem, sort_bin, block_bin);
+    } else if (has_file_ext(link_file, ".pairs") || has_file_ext(link_file, ".pairs.gz")) {
+        link_bin_file = malloc(strlen(out) + 5);
+        sprintf(link_bin_file, "%s.bin", out);
+        fprintf(stderr, "[I::%s] dump hic links (PAIRS) to binary file %s\n", __func__, link_bin_file);
+        dump_links_from_pairs_file(link_file, fai, link_bin_file, n_threads, max_mem, sort_bin, block_bin);
     } else if (strcmp(ext, ".bin") == 0) {
         link_bin_file = malloc(strlen(link_file) + 1);
         sprintf(link_bin_file, "%s", link_file);
-        if (ml > 0)
-            fprintf(stderr, "[W::%s] contig length threshold %d applied, make sure the binary file %s is up to date\n", __func__, ml, link_bin_file);
+        bin_reader_t *bin = bin_reader_open(link_bin_file, NULL, 0);
+        if (bin->ver == 0 && ml > 0)
+            fprintf(stderr, "[W::%s] contig length threshold %d applied, make sure the legacy binary file %s is up to date\n", __func__, ml, link_bin_file);
+        if (bin->ver > 0 && mq8 < bin->mq)
+            fprintf(stderr, "[W::%s] binary file %s was dumped with mapping quality threshold %u, links below it are not available\n", __func__, link_bin_file, bin->mq);
+        if (!(bin->flags & BIN_FLAG_QUAL) && mq8 != bin->mq)
+            fprintf(stderr, "[W::%s] binary file %s has no mapping qualities, mapping quality threshold %hhu is not applied\n", __func__, link_bin_file, mq8);
+        bin_reader_close(bin);
     } else {
-        fprintf(stderr, "[E::%s] unknown link file format. File extension .bam, .bed or .bin is expected\n", __func__);
+        fprintf(stderr, "[E::%s] unknown link file format. File extension .bam, .bed(.gz), .bedpe(.gz), .pairs(.gz) or .bin is expected\n", __func__);
         exit(EXIT_FAILURE);
     }
 
@@ -742,6 +864,11 @@ int main(int argc, char *argv[])
     printf("[I::%s] RE:    %s\n", __func__, ecstr);
     printf("[I::%s] minl:  %d\n", __func__, ml);
     printf("[I::%s] minq:  %hhu\n", __func__, mq8);
+    printf("[I::%s] nthr:  %d\n", __func__, n_threads);
+    printf("[I::%s] bmem:  %ld\n", __func__, max_mem);
+    printf("[I::%s] sortb: %d\n", __func__, sort_bin);
+    printf("[I::%s] blkb:  %d\n", __func__, block_bin);
+    printf("[I::%s] cbin:  %d\n", __func__, cache_bin);
     printf("[I::%s] nr:    %d\n", __func__, nr);
     int i;
     for (i = 0; i < nr; ++i)
@@ -751,7 +878,7 @@ int main(int argc, char *argv[])
     printf("[I::%s] ec[S]: %d\n", __func__, no_scaffold_ec);
 #endif
 
-    ret = run_yahs(fai, agp, link_bin_file, ml, out, resolutions, nr, re_cuts, no_contig_ec, no_scaffold_ec);
+    ret = run_yahs(fai, agp, link_bin_file, ml, mq8, cache_bin, out, resolutions, nr, re_cuts, no_contig_ec, no_scaffold_ec, n_threads);
     
     if (ret == 0) {
         agp_final = (char *) malloc(strlen(out) + 35);